@@ -27,6 +27,11 @@
 //
 #include "amd64.hpp"
 #include "flags.hpp"
+#include "lazy_flags.hpp"
+#include "fusion.hpp"
+#include "flag_update.hpp"
+#include "../core/processing_flags.hpp"
+#include "../core/replay_cache.hpp"
 
 namespace vtil::lifter::amd64
 {
@@ -105,6 +110,63 @@ namespace vtil::lifter::amd64
 		return current_offs;
 	}
 
+	// Load an operand of the given kind.
+	//
+	template<x86_op_type type>
+	operand load_operand( basic_block* block, const operand_info& opr )
+	{
+		if constexpr ( type == X86_OP_IMM )
+		{
+			return { opr.imm, opr.size * 8 };
+		}
+		else if constexpr ( type == X86_OP_REG )
+		{
+			return reg2op( opr.reg );
+		}
+		else
+		{
+			auto tmp = block->tmp( opr.size * 8 );
+			block
+				->ldd( tmp, get_disp_from_operand( block, opr ), 0 );
+			return { tmp };
+		}
+	}
+	template operand load_operand<X86_OP_IMM>( basic_block*, const operand_info& );
+	template operand load_operand<X86_OP_REG>( basic_block*, const operand_info& );
+	template operand load_operand<X86_OP_MEM>( basic_block*, const operand_info& );
+
+	// Store to an operand of the given kind.
+	//
+	template<x86_op_type type>
+	void store_operand( basic_block* block, const operand_info& opr, const operand& source )
+	{
+		if constexpr ( type == X86_OP_REG )
+		{
+			operand op = reg2op( opr.reg );
+
+			// 32-bit writes clear the upper half, which is done with a single write to the full
+			// register as mov zero-extends the value it is given.
+			//
+			operand value = source;
+			if ( op.bit_count() == 32 && op.reg().bit_offset == 0 )
+			{
+				op.reg().bit_count = 64;
+				if ( value.is_immediate() )
+					value = operand( value.imm().u64 & 0xFFFFFFFF, 64 );
+				else if ( value.bit_count() > 32 )
+					value.reg().bit_count = 32;
+			}
+			block->mov( op, value );
+		}
+		else
+		{
+			static_assert( type == X86_OP_MEM, "Cannot store to an immediate." );
+			block->str( get_disp_from_operand( block, opr ), 0, source );
+		}
+	}
+	template void store_operand<X86_OP_REG>( basic_block*, const operand_info&, const operand& );
+	template void store_operand<X86_OP_MEM>( basic_block*, const operand_info&, const operand& );
+
 	// Load a register, immediate, or memory operand from the given instruction and operand index.
 	//
 	operand load_operand( basic_block* block, const instruction_info& insn, size_t idx )
@@ -116,21 +178,16 @@ namespace vtil::lifter::amd64
 		switch ( opr.type )
 		{
 			case X86_OP_IMM:
-				return { opr.imm, opr.size * 8 };
+				return load_operand<X86_OP_IMM>( block, opr );
 			case X86_OP_REG:
 			{
+				// Copy the register so that the value stays valid after stores.
 				auto tmp = block->tmp( opr.size * 8 );
-				auto reg = reg2op( opr.reg );
-				block->mov( tmp, reg );
+				block->mov( tmp, load_operand<X86_OP_REG>( block, opr ) );
 				return { tmp };
 			}
 			case X86_OP_MEM:
-			{
-				auto tmp = block->tmp( opr.size * 8 );
-				block
-					->ldd( tmp, get_disp_from_operand( block, opr ), 0 );
-				return { tmp };
-			}
+				return load_operand<X86_OP_MEM>( block, opr );
 			default:
 				unreachable();
 		}
@@ -147,51 +204,73 @@ namespace vtil::lifter::amd64
 		switch ( opr.type )
 		{
 			case X86_OP_REG:
-			{
-				operand op = reg2op( opr.reg );
-				if ( op.bit_count() == 32 )
-				{
-					operand op_hi = op;
-					op_hi.reg().bit_offset += 32;
-					block->mov( op_hi, 0ull );
-				}
-				block->mov( op, source );
-				break;
-			}
+				return store_operand<X86_OP_REG>( block, opr, source );
 			case X86_OP_MEM:
-			{
-				block->str( get_disp_from_operand( block, opr ), 0, source );
-				break;
-			}
+				return store_operand<X86_OP_MEM>( block, opr, source );
 			case X86_OP_IMM:
 			default:
 				unreachable();
 		}
 	}
 
-	size_t lifter_t::process( basic_block* block, uint64_t vip, uint8_t* code )
+	// Value of RIP not yet written to the block, the register is only updated before
+	// instructions observing it and at the end of the block.
+	//
+	struct pending_rip
+	{
+		const basic_block* block = nullptr;
+		uint64_t value = 0;
+	};
+	static thread_local pending_rip deferred_rip = {};
+
+	// Translator shared by the instructions of the block being lifted.
+	//
+	static thread_local block_translator translator = {};
+
+	// Decoder resolving the registers accessed by the instructions emitted as is.
+	//
+	static thread_local decoder_context fallback_decoder;
+
+	// IL of the instructions lifted so far, shared by all threads.
+	//
+	static replay_cache instruction_templates;
+
+	replay_statistics lifter_t::replay_stats()
+	{
+		return instruction_templates.statistics();
+	}
+
+	const instruction_info* lifter_t::decode( decoder_t& decoder, uint64_t vip, const uint8_t* code, size_t max_length )
 	{
-		const auto& insns = vtil::amd64::disasm( code, vip, 0 );
-		if ( insns.empty() )
+		return decoder.decode( vip, code, max_length );
+	}
+
+	size_t lifter_t::process( basic_block* block, decoder_t& decoder, uint64_t vip, uint8_t* code, size_t max_length )
+	{
+		auto insn = decode( decoder, vip, code, max_length );
+		if ( !insn )
 		{
+			end_block( block );
 			handle_instruction( block, { .id = X86_INS_INVALID } );
 			return 0;
 		}
+		return process( block, *insn );
+	}
 
-		const auto& insn = insns[ 0 ];
-		code += insn.bytes.size();
-
-		batch_translator translator = { block };
+	size_t lifter_t::process( basic_block* block, const instruction_info& insn )
+	{
+		translator.begin( block );
 		lifter::operative::translator = &translator;
 
-		block->mov( reg2op( X86_REG_RIP ), vip + insn.bytes.size() );
-
 		// Validate operands:
 		//
+		constexpr auto is_rip = [ ] ( const auto& op )
+		{
+			return op == X86_REG_RIP || op == X86_REG_EIP || op == X86_REG_IP;
+		};
 		constexpr auto is_valid = [ ] ( const auto& op )
 		{
-			return vtil::amd64::registers.is_generic( op ) ||
-				op == X86_REG_RIP || op == X86_REG_EIP || op == X86_REG_IP;
+			return vtil::amd64::registers.is_generic( op ) || is_rip( op );
 		};
 
 		bool is_invalid = false;
@@ -217,9 +296,66 @@ namespace vtil::lifter::amd64
 			}
 		}
 		
+		handler_t handler = is_invalid ? nullptr : find_handler( insn.id );
+
+		// Update RIP if the instruction may observe it, otherwise defer it until it is.
+		//
+		bool reads_rip = !handler || is_branch( insn.id ) || may_emit_native( insn.id ) ||
+			block->owner->context.get<processing_flags>().always_update_rip;
+		for ( auto& operand : insn.operands )
+		{
+			if ( operand.type == X86_OP_REG )
+				reads_rip |= is_rip( operand.reg );
+			else if ( operand.type == X86_OP_MEM )
+				reads_rip |= is_rip( operand.mem.base ) || is_rip( operand.mem.index );
+		}
+
+		if ( reads_rip )
+		{
+			block->mov( reg2op( X86_REG_RIP ), insn.address + insn.bytes.size() );
+			deferred_rip = {};
+		}
+		else
+		{
+			deferred_rip = { block, insn.address + insn.bytes.size() };
+		}
+
+		// Bring any deferred flags up to date for this instruction.
+		//
+		if ( flags::is_lazy( block ) )
+			flags::prepare( block, insn, handler != nullptr );
+
+		// The IL of an instruction only depends on its encoding unless its handler observes the
+		// flags deferred by the lazy flags or a comparison preceding it, or ends the block.
+		//
+		bool replayable = handler && !is_branch( insn.id ) &&
+			block->owner->context.get<processing_flags>().replay_templates &&
+			( !flags::is_lazy( block ) || !insn.eflags ) &&
+			!flags::has_comparison( block, insn.address );
+
+		std::string template_key;
+		std::shared_ptr<const il_template> tmpl;
+		if ( replayable )
+		{
+			template_key = replay_cache::make_key( CS_MODE_64, { insn.bytes.data(), insn.bytes.size() }, flags::is_coalesced( block ) );
+			tmpl = instruction_templates.lookup( template_key );
+		}
+
+		if ( tmpl )
+		{
+			replay_cache::replay( block, *tmpl );
+			return insn.bytes.size();
+		}
+
 		// If is invalid or could not handle:
 		//
-		if ( is_invalid || !handle_instruction( block, insn ) )
+		capture_point point = { block };
+		flags::expect_undefined( block, insn.eflags );
+		if ( handler )
+		{
+			handler( block, insn );
+		}
+		else
 		{
 			// Hint all side effects.
 			//
@@ -238,14 +374,15 @@ namespace vtil::lifter::amd64
 				}
 			}
 
-			for ( auto& reg : insn.regs_read )
-				block->vpinr( ( x86_reg ) reg );
+			auto access = fallback_decoder.access( insn );
+			for ( size_t i = 0; i != access.read_count; i++ )
+				block->vpinr( ( x86_reg ) access.read[ i ] );
 
 			for ( auto byte : insn.bytes )
 				block->vemit( byte );
 
-			for ( auto& reg : insn.regs_write )
-				block->vpinw( ( x86_reg ) reg );
+			for ( size_t i = 0; i != access.write_count; i++ )
+				block->vpinw( ( x86_reg ) access.write[ i ] );
 
 			for ( auto& operand : insn.operands )
 				if ( operand.type == X86_OP_REG && ( operand.access & CS_AC_WRITE ) )
@@ -261,15 +398,43 @@ namespace vtil::lifter::amd64
 			if ( insn.eflags & X86_EFLAGS_MODIFY_IF ) block->vpinw( flags::IF );
 		}
 
-		// Enforce undefined bits.
+		// Enforce undefined bits not already written along with the flags of the handler.
+		//
+		flags::write_undefined( block );
+
+		// Comparisons are recorded for the instruction following them, which a replay would skip.
 		//
-		if ( insn.eflags & X86_EFLAGS_UNDEFINED_OF ) block->mov( flags::OF, UNDEFINED );
-		if ( insn.eflags & X86_EFLAGS_UNDEFINED_SF ) block->mov( flags::SF, UNDEFINED );
-		if ( insn.eflags & X86_EFLAGS_UNDEFINED_ZF ) block->mov( flags::ZF, UNDEFINED );
-		if ( insn.eflags & X86_EFLAGS_UNDEFINED_PF ) block->mov( flags::PF, UNDEFINED );
-		if ( insn.eflags & X86_EFLAGS_UNDEFINED_AF ) block->mov( flags::AF, UNDEFINED );
-		if ( insn.eflags & X86_EFLAGS_UNDEFINED_CF ) block->mov( flags::CF, UNDEFINED );
+		if ( replayable && !flags::has_comparison( block, insn.address + insn.bytes.size() ) )
+			instruction_templates.capture( template_key, point );
 
 		return insn.bytes.size();
 	}
+
+	void lifter_t::end_block( basic_block* block )
+	{
+		if ( deferred_rip.block == block )
+		{
+			block->mov( reg2op( X86_REG_RIP ), deferred_rip.value );
+			deferred_rip = {};
+		}
+
+		if ( flags::is_lazy( block ) )
+		{
+			translator.begin( block );
+			lifter::operative::translator = &translator;
+			flags::materialize( block );
+		}
+		translator.reset();
+	}
+
+	bool lifter_t::is_boundary( const basic_block* block, uint64_t vip )
+	{
+		return !flags::has_pending( block ) && !flags::has_comparison( block, vip );
+	}
+
+	void lifter_t::mark_boundary( basic_block* block )
+	{
+		if ( translator.block == block )
+			translator.drop_temporaries();
+	}
 };
@@ -28,8 +28,12 @@
 #pragma once
 #include <vtil/amd64>
 #include <vtil/arch>
-#include <functional>
-#include <map>
+#include <array>
+#include <span>
+#include <vector>
+#include "predecoder.hpp"
+#include "decoder.hpp"
+#include "../core/replay_statistics.hpp"
 
 // This file defines any global arch-specific information for the AMD64 target
 // architecture.
@@ -37,63 +41,201 @@
 namespace vtil::lifter::amd64
 {
 	using operand_info = cs_x86_op;
-	using instruction_info = vtil::amd64::instruction;
 
 	struct lifter_t
 	{
-		// Disassemble and process an instruction.
+		using instruction_info = amd64::instruction_info;
+		using decoder_t = decoder_context;
+
+		// Disassembles a single instruction reading at most max_length bytes, returns nullptr if it
+		// could not be decoded. The result is owned by the decoder and is only valid until its next use.
+		//
+		static const instruction_info* decode( decoder_t& decoder, uint64_t vip, const uint8_t* code, size_t max_length );
+
+		// Disassemble and process an instruction, reading at most max_length bytes.
+		// Returns the length of the instruction processed.
+		//
+		static size_t process( basic_block* block, decoder_t& decoder, uint64_t vip, uint8_t* code, size_t max_length );
+
+		// Process an already disassembled instruction.
 		// Returns the length of the instruction processed.
 		//
-		static size_t process( basic_block* block, uint64_t vip, uint8_t* code );
+		static size_t process( basic_block* block, const instruction_info& insn );
+
+		// Completes any state deferred by the lifter, must be called before the
+		// explorer terminates a block on its own.
+		//
+		static void end_block( basic_block* block );
+
+		// Checks that nothing the lifter deferred is carried into the instruction at the given
+		// address, meaning the block may later be split in two right before it.
+		//
+		static bool is_boundary( const basic_block* block, uint64_t vip );
+
+		// Stops reusing the temporaries cached by the block translator past the boundary the
+		// explorer just recorded, as a temporary live across it would keep the block from
+		// being split there.
+		//
+		static void mark_boundary( basic_block* block );
+
+		// Returns the destinations of the branch terminating the block if the lifter took all of
+		// them from the instruction itself, or nothing if the branch has to be analyzed.
+		//
+		static std::vector<uint64_t> direct_targets( const basic_block* block );
+
+		// Returns how often the IL of an instruction was replayed from an earlier encoding.
+		//
+		static replay_statistics replay_stats();
+
+		// Determines the length and the direct control flow of an instruction without disassembling it.
+		//
+		static length_info predecode( uint64_t vip, const uint8_t* code, size_t max_length )
+		{
+			return amd64::predecode( vip, code, max_length );
+		}
 	};
 
 	operand load_operand( basic_block* block, const instruction_info& insn, size_t idx );
 	register_desc get_disp_from_operand( basic_block* block, const operand_info& operand );
 	void store_operand( basic_block* block, const instruction_info& insn, size_t idx, const operand& source );
 
+	// Loads and stores specialized for a single kind of operand. Unlike the generic versions
+	// above, register operands are referenced directly instead of being copied to a temporary,
+	// so the caller must not read the result once the register has been written to.
+	//
+	template<x86_op_type type> operand load_operand( basic_block* block, const operand_info& opr );
+	template<x86_op_type type> void store_operand( basic_block* block, const operand_info& opr, const operand& source );
+
 	// Implement ::handle_instruction.
 	//
-	using handler_map_t = std::map<x86_insn, std::function<void( basic_block*, const instruction_info& )>>;
+	using handler_t = void( * )( basic_block*, const instruction_info& );
+	using handler_table_t = std::array<handler_t, X86_INS_ENDING>;
+
+	// Each semantic unit exposes a constant list of the handlers it implements,
+	// these are constant-initialized and thus safe to use at any point in time.
+	//
+	struct handler_entry
+	{
+		x86_insn id;
+		handler_t handler;
+	};
+	using handler_list_t = std::span<const handler_entry>;
 
 	namespace impl
 	{
-		static handler_map_t& merge_maps( handler_map_t& m0 ) { return m0; }
+		// Checks if no instruction is handled more than once in the given list.
+		//
+		template<size_t N>
+		static constexpr bool is_unique( const handler_entry( &list )[ N ] )
+		{
+			for ( size_t i = 0; i != N; i++ )
+				for ( size_t j = i + 1; j != N; j++ )
+					if ( list[ i ].id == list[ j ].id )
+						return false;
+			return true;
+		}
+	};
+
+	extern const handler_list_t flags_handlers;
+	extern const handler_list_t misc_handlers;
+	extern const handler_list_t comparison_handlers;
+	extern const handler_list_t branch_handlers;
+	extern const handler_list_t arithmetic_handlers;
 
-		template<typename... Tx>
-		static handler_map_t& merge_maps( handler_map_t& m0, handler_map_t& m1, Tx&&... maps )
+	// Flattens the handler lists into a table indexed by the instruction identifier.
+	//
+	inline const handler_table_t& get_handler_table()
+	{
+		static const handler_table_t handler_table = [ ] ()
 		{
-			for ( auto&& [k, v] : m1 )
+			handler_table_t table = {};
+			for ( handler_list_t list : { flags_handlers, misc_handlers, comparison_handlers, branch_handlers, arithmetic_handlers } )
 			{
-				fassert( !m0.contains( k ) );
-				m0.emplace( k, std::move( v ) );
+				for ( auto& [id, handler] : list )
+				{
+					fassert( !table[ id ] );
+					table[ id ] = handler;
+				}
+			}
+			return table;
+		}();
+		return handler_table;
+	}
+
+	// Kinds of the destination and the source operand of a two-operand instruction.
+	//
+	template<x86_op_type dst, x86_op_type src>
+	struct operand_shape
+	{
+		static constexpr x86_op_type destination = dst;
+		static constexpr x86_op_type source = src;
+	};
+
+	// Creates a handler out of a generic one taking the operand shape as its first argument,
+	// the instantiation matching the operands is selected once per instruction.
+	//
+	template<auto handler>
+	inline constexpr handler_t shape_dispatch = [ ] ( basic_block* block, const instruction_info& insn )
+	{
+		auto dst = insn.operands[ 0 ].type;
+		auto src = insn.operands[ 1 ].type;
+
+		if ( dst == X86_OP_REG )
+		{
+			switch ( src )
+			{
+				case X86_OP_REG: return handler( operand_shape<X86_OP_REG, X86_OP_REG>{}, block, insn );
+				case X86_OP_IMM: return handler( operand_shape<X86_OP_REG, X86_OP_IMM>{}, block, insn );
+				case X86_OP_MEM: return handler( operand_shape<X86_OP_REG, X86_OP_MEM>{}, block, insn );
+				default:         break;
 			}
-			return merge_maps( m0, std::forward<Tx>( maps )... );
 		}
+		else if ( dst == X86_OP_MEM )
+		{
+			switch ( src )
+			{
+				case X86_OP_REG: return handler( operand_shape<X86_OP_MEM, X86_OP_REG>{}, block, insn );
+				case X86_OP_IMM: return handler( operand_shape<X86_OP_MEM, X86_OP_IMM>{}, block, insn );
+				default:         break;
+			}
+		}
+		unreachable();
 	};
 
-	extern handler_map_t flags_handlers;
-	extern handler_map_t misc_handlers;
-	extern handler_map_t comparison_handlers;
-	extern handler_map_t branch_handlers;
-	extern handler_map_t arithmetic_handlers;
+	// Checks if the instruction is lifted by a branch handler, which always ends the block.
+	//
+	inline bool is_branch( uint32_t id )
+	{
+		static const std::array<bool, X86_INS_ENDING> branch_table = [ ] ()
+		{
+			std::array<bool, X86_INS_ENDING> table = {};
+			for ( auto& [id, handler] : branch_handlers )
+				table[ id ] = true;
+			return table;
+		}();
+		return id < X86_INS_ENDING && branch_table[ id ];
+	}
+
+	// Checks if the handler of the instruction may emit native code, as ENTER does for the
+	// encodings that fault, which observes RIP just like an instruction without a handler.
+	//
+	inline bool may_emit_native( uint32_t id )
+	{
+		return id == X86_INS_ENTER || id == X86_INS_INVALID;
+	}
 
-	inline handler_map_t& get_instruction_handlers()
+	static handler_t find_handler( uint32_t id )
 	{
-		static handler_map_t& instruction_handlers = impl::merge_maps(
-			flags_handlers, misc_handlers, comparison_handlers,
-			branch_handlers, arithmetic_handlers
-		);
-		return instruction_handlers;
+		if ( id >= X86_INS_ENDING )
+			return nullptr;
+		return get_handler_table()[ id ];
 	}
 
 	static bool handle_instruction( basic_block* block, const instruction_info& ins )
 	{
-		handler_map_t& instruction_handlers = get_instruction_handlers();
-
-		auto it = instruction_handlers.find( ( x86_insn ) ins.id );
-		if ( it != instruction_handlers.end() )
+		if ( handler_t handler = find_handler( ins.id ) )
 		{
-			it->second( block, ins );
+			handler( block, ins );
 			return true;
 		}
 
@@ -0,0 +1,83 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "decoder.hpp"
+#include <algorithm>
+
+namespace vtil::lifter::amd64
+{
+	decoder_context::decoder_context()
+	{
+		fassert( cs_open( CS_ARCH_X86, CS_MODE_64, &handle ) == CS_ERR_OK );
+		fassert( cs_option( handle, CS_OPT_DETAIL, CS_OPT_ON ) == CS_ERR_OK );
+		raw = cs_malloc( handle );
+		fassert( raw );
+	}
+
+	decoder_context::~decoder_context()
+	{
+		cs_free( raw, 1 );
+		cs_close( &handle );
+	}
+
+	const instruction_info* decoder_context::decode( uint64_t vip, const uint8_t* code, size_t max_length )
+	{
+		// Never read past the longest encoding, the caller bounds the rest.
+		//
+		max_length = std::min<size_t>( max_length, 15 );
+		uint64_t address = vip;
+		if ( !cs_disasm_iter( handle, &code, &max_length, &address, raw ) )
+			return nullptr;
+
+		// Copy the details into the reused record.
+		//
+		const cs_x86& x86 = raw->detail->x86;
+		result.id = raw->id;
+		result.address = raw->address;
+		result.bytes.assign( raw->bytes, raw->bytes + raw->size );
+		result.operands.assign( x86.operands, x86.operands + x86.op_count );
+		std::copy_n( x86.prefix, std::size( x86.prefix ), std::begin( result.prefix ) );
+		result.addr_size = x86.addr_size;
+		result.eflags = x86.eflags;
+		return &result;
+	}
+
+	register_access decoder_context::access( const instruction_info& insn )
+	{
+		register_access result = {};
+
+		const uint8_t* code = insn.bytes.data();
+		size_t length = insn.bytes.size();
+		uint64_t address = insn.address;
+		if ( cs_disasm_iter( handle, &code, &length, &address, raw ) &&
+			 cs_regs_access( handle, raw, result.read, &result.read_count, result.write, &result.write_count ) != CS_ERR_OK )
+		{
+			result.read_count = result.write_count = 0;
+		}
+		return result;
+	}
+};
@@ -0,0 +1,119 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/amd64>
+#include <algorithm>
+
+namespace vtil::lifter::amd64
+{
+	// Sequence of at most N values stored inline.
+	//
+	template<typename T, size_t N>
+	struct inline_vector
+	{
+		T values[ N ] = {};
+		uint8_t count = 0;
+
+		void assign( const T* first, const T* last )
+		{
+			count = uint8_t( std::min<size_t>( last - first, N ) );
+			std::copy_n( first, count, values );
+		}
+
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		T* data() { return values; }
+		const T* data() const { return values; }
+		T* begin() { return values; }
+		const T* begin() const { return values; }
+		T* end() { return values + count; }
+		const T* end() const { return values + count; }
+		T& operator[]( size_t n ) { return values[ n ]; }
+		const T& operator[]( size_t n ) const { return values[ n ]; }
+	};
+
+	// Details of a decoded instruction the lifter consumes. Kept trivially copyable and free of
+	// any allocation so that decoding into it and caching it costs no more than a copy.
+	//
+	struct instruction_info
+	{
+		uint32_t id = X86_INS_INVALID;
+		uint64_t address = 0;
+		inline_vector<uint8_t, 15> bytes = {};
+		inline_vector<cs_x86_op, 8> operands = {};
+		uint8_t prefix[ 4 ] = {};
+		uint8_t addr_size = 0;
+		uint64_t eflags = 0;
+	};
+
+	// Registers read and written by an instruction, including the implicit ones.
+	//
+	struct register_access
+	{
+		cs_regs read = {};
+		cs_regs write = {};
+		uint8_t read_count = 0;
+		uint8_t write_count = 0;
+	};
+
+	// Decoder context holding a capstone handle and the storage for the instruction being
+	// decoded, both of which are reused across calls. Unlike vtil::amd64::disasm, only the
+	// details the lifter consumes are extracted and the textual representation is not kept.
+	//
+	// Not thread-safe, each thread lifting instructions should own its own context.
+	//
+	class decoder_context
+	{
+		// Capstone handle and the instruction buffer allocated for it.
+		//
+		csh handle = 0;
+		cs_insn* raw = nullptr;
+
+		// Last instruction decoded.
+		//
+		instruction_info result = {};
+
+	public:
+		// Constructor and destructor, contexts are not copyable.
+		//
+		decoder_context();
+		~decoder_context();
+		decoder_context( const decoder_context& ) = delete;
+		decoder_context& operator=( const decoder_context& ) = delete;
+
+		// Decodes the instruction at the given address reading at most max_length bytes, returns
+		// nullptr on failure. The result is only valid until the next call.
+		//
+		const instruction_info* decode( uint64_t vip, const uint8_t* code, size_t max_length );
+
+		// Determines the registers accessed by an instruction by decoding its bytes again. Only
+		// instructions without a handler need these, so they are not kept with every instruction.
+		//
+		register_access access( const instruction_info& insn );
+	};
+};
@@ -0,0 +1,174 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "flag_update.hpp"
+#include "../core/processing_flags.hpp"
+#include <array>
+#include <optional>
+#include <utility>
+
+namespace vtil::lifter::amd64::flags
+{
+	// Flags left undefined by the instruction being lifted.
+	//
+	struct undefined_flags
+	{
+		const basic_block* block = nullptr;
+		uint64_t eflags = 0;
+	};
+	static thread_local undefined_flags pending_undefined = {};
+
+	// Flags that can be left undefined, in the order they were always written in.
+	//
+	static constexpr std::pair<const register_desc*, uint64_t> undefined_effects[] = {
+		{ &OF, X86_EFLAGS_UNDEFINED_OF },
+		{ &SF, X86_EFLAGS_UNDEFINED_SF },
+		{ &ZF, X86_EFLAGS_UNDEFINED_ZF },
+		{ &PF, X86_EFLAGS_UNDEFINED_PF },
+		{ &AF, X86_EFLAGS_UNDEFINED_AF },
+		{ &CF, X86_EFLAGS_UNDEFINED_CF },
+	};
+
+	// Undefined value of a single flag.
+	//
+	static const register_desc undefined_bit = { register_undefined, 0, 1, 0 };
+
+	// Takes over the flags the current instruction leaves undefined.
+	//
+	static uint64_t take_undefined( const basic_block* block )
+	{
+		if ( pending_undefined.block != block )
+			return 0;
+		return std::exchange( pending_undefined, {} ).eflags;
+	}
+
+	bool is_coalesced( const basic_block* block )
+	{
+		return block->owner->context.get<processing_flags>().coalesce_flags;
+	}
+
+	void expect_undefined( const basic_block* block, uint64_t eflags )
+	{
+		uint64_t undefined = 0;
+		for ( auto& [ flag, mask ] : undefined_effects )
+			undefined |= eflags & mask;
+		pending_undefined = { block, undefined };
+	}
+
+	void write_undefined( basic_block* block )
+	{
+		// Coalesced updates take the undefined flags over on their own.
+		//
+		flag_update update = { block };
+		if ( !is_coalesced( block ) )
+		{
+			uint64_t undefined = take_undefined( block );
+			for ( auto& [ flag, mask ] : undefined_effects )
+				if ( undefined & mask )
+					update.set( *flag, operative( UNDEFINED ) );
+		}
+		update.emit();
+	}
+
+	void flag_update::emit()
+	{
+		if ( !is_coalesced( block ) )
+		{
+			for ( auto& [ flag, type, value ] : entries )
+			{
+				if ( type == kind::set )
+					block->mov( flag, value );
+				else
+					block->bxor( flag, value );
+			}
+			entries.clear();
+			return;
+		}
+
+		// Undefined flags are written last, as the lifter would have done after the handler.
+		//
+		uint64_t undefined = take_undefined( block );
+		for ( auto& [ flag, mask ] : undefined_effects )
+			if ( undefined & mask )
+				set( *flag, operative( undefined_bit ) );
+
+		// Resolve the final value of each bit.
+		//
+		std::array<std::optional<operative>, 64> values = {};
+		bitcnt_t low = 64, high = 0;
+		for ( auto& [ flag, type, value ] : entries )
+		{
+			auto& current = values[ flag.bit_offset ];
+			if ( type == kind::set )
+				current = value;
+			else
+				current = ( current ? *current : operative( flag ) ) ^ value;
+
+			low = std::min( low, flag.bit_offset );
+			high = std::max( high, flag.bit_offset );
+		}
+		entries.clear();
+		if ( low > high )
+			return;
+
+		// A single flag needs no composition.
+		//
+		if ( low == high )
+		{
+			block->mov( register_desc{ register_physical | register_flags, 0, 1, low }, *values[ low ] );
+			return;
+		}
+
+		// Compose the range, reading back the bits not written in runs.
+		//
+		bitcnt_t width = high - low + 1;
+		std::optional<operative> composed;
+		auto merge = [ & ] ( const operative& term )
+		{
+			composed = composed ? ( *composed | term ) : term;
+		};
+
+		for ( bitcnt_t bit = low; bit <= high; )
+		{
+			if ( values[ bit ] )
+			{
+				merge( __if( *values[ bit ], operative( operand( 1ull << ( bit - low ), width ) ) ) );
+				bit++;
+				continue;
+			}
+
+			bitcnt_t run = bit;
+			while ( !values[ run ] ) run++;
+
+			operative kept = operative( register_desc{ register_physical | register_flags, 0, run - bit, bit } );
+			merge( bit == low ? kept.zext( width ) : ( kept.zext( width ) << ( bit - low ) ) );
+			bit = run;
+		}
+
+		block->mov( register_desc{ register_physical | register_flags, 0, width, low }, *composed );
+	}
+};
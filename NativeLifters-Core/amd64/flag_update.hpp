@@ -0,0 +1,100 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include "amd64.hpp"
+#include "flags.hpp"
+
+// Writes of the status flags produced by a single instruction. Normally every flag is written
+// on its own, when coalescing is enabled the values are composed into a single write covering
+// the range of the flags register they span, with the bits in between carried over.
+//
+namespace vtil::lifter::amd64::flags
+{
+	// Checks if the flag writes of the given block are coalesced.
+	//
+	bool is_coalesced( const basic_block* block );
+
+	// Records the flags the instruction being lifted leaves undefined, in coalesced mode the first
+	// update written by its handler takes them over.
+	//
+	void expect_undefined( const basic_block* block, uint64_t eflags );
+
+	// Writes the flags left undefined by the instruction that no update took over.
+	//
+	void write_undefined( basic_block* block );
+
+	struct flag_update
+	{
+		enum class kind
+		{
+			set,
+			toggle,
+		};
+
+		struct entry
+		{
+			register_desc flag;
+			kind type;
+			operative value;
+		};
+
+		basic_block* block;
+		std::vector<entry> entries;
+
+		flag_update( basic_block* block )
+			: block( block ) {}
+
+		// Overwrites the flag with the given value.
+		//
+		flag_update& set( const register_desc& flag, const operative& value )
+		{
+			entries.push_back( { flag, kind::set, value } );
+			return *this;
+		}
+
+		// Inverts the flag where the given value is set.
+		//
+		flag_update& toggle( const register_desc& flag, const operative& value )
+		{
+			entries.push_back( { flag, kind::toggle, value } );
+			return *this;
+		}
+
+		// Overwrites the flag with the given value only if the condition is set.
+		//
+		flag_update& set_if( const register_desc& flag, const operative& condition, const operative& value )
+		{
+			return set( flag, operative::select( condition, value, operative( flag ) ) );
+		}
+
+		// Emits the writes to the block, in the order they were added unless coalesced.
+		//
+		void emit();
+	};
+};
@@ -79,6 +79,60 @@ namespace vtil::lifter::amd64::flags
 		return ( ( value & 0xFF ).popcnt() & 1 ) == 0;
 	}
 
+	// Conditions tested by jcc, setcc and cmovcc, in encoding order.
+	//
+	enum class condition_code : uint8_t
+	{
+		o,
+		no,
+		b,
+		ae,
+		e,
+		ne,
+		be,
+		a,
+		s,
+		ns,
+		p,
+		np,
+		l,
+		ge,
+		le,
+		g
+	};
+
+	// Evaluates a condition from the flag registers.
+	//
+	static operative condition( condition_code cc )
+	{
+		operative cf( CF );
+		operative pf( PF );
+		operative zf( ZF );
+		operative sf( SF );
+		operative of( OF );
+
+		switch ( cc )
+		{
+			case condition_code::o:  return of == 1;
+			case condition_code::no: return of == 0;
+			case condition_code::b:  return cf == 1;
+			case condition_code::ae: return cf == 0;
+			case condition_code::e:  return zf == 1;
+			case condition_code::ne: return zf == 0;
+			case condition_code::be: return ( cf == 1 ) | ( zf == 1 );
+			case condition_code::a:  return ( cf == 0 ) & ( zf == 0 );
+			case condition_code::s:  return sf == 1;
+			case condition_code::ns: return sf == 0;
+			case condition_code::p:  return pf == 1;
+			case condition_code::np: return pf == 0;
+			case condition_code::l:  return sf != of;
+			case condition_code::ge: return sf == of;
+			case condition_code::le: return ( zf == 1 ) | ( sf != of );
+			case condition_code::g:  return ( zf == 0 ) & ( sf == of );
+			default:                 unreachable();
+		}
+	}
+
 	// Specifies the type of operation flags should be determined for
 	//
 	enum flag_operation : uint32_t
@@ -0,0 +1,123 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "fusion.hpp"
+#include <optional>
+
+namespace vtil::lifter::amd64::flags
+{
+	// Last comparison lifted on this thread.
+	//
+	struct comparison
+	{
+		const basic_block* block = nullptr;
+		uint64_t next_vip = invalid_vip;
+
+		flag_operation op = sub;
+		operand lhs;
+		operand rhs;
+	};
+	static thread_local comparison last_comparison = {};
+
+	// Computes the condition directly from the operands of a comparison if possible.
+	//
+	static std::optional<operative> evaluate_fused( const comparison& cmp, condition_code cc )
+	{
+		operative lhs = cmp.lhs;
+		operative rhs = cmp.rhs;
+
+		if ( cmp.op == sub )
+		{
+			switch ( cc )
+			{
+				case condition_code::b:  return __uless( lhs, rhs );
+				case condition_code::ae: return __ugreat_eq( lhs, rhs );
+				case condition_code::e:  return lhs == rhs;
+				case condition_code::ne: return lhs != rhs;
+				case condition_code::be: return __uless_eq( lhs, rhs );
+				case condition_code::a:  return __ugreat( lhs, rhs );
+				case condition_code::s:  return sign( lhs - rhs );
+				case condition_code::ns: return sign( lhs - rhs ) == 0;
+				case condition_code::l:  return lhs < rhs;
+				case condition_code::ge: return lhs >= rhs;
+				case condition_code::le: return lhs <= rhs;
+				case condition_code::g:  return lhs > rhs;
+				default:                 return std::nullopt;
+			}
+		}
+		else if ( cmp.op == band )
+		{
+			// CF and OF are cleared, leaving only ZF and SF to test.
+			//
+			auto result = lhs & rhs;
+			switch ( cc )
+			{
+				case condition_code::e:
+				case condition_code::be: return result == 0;
+				case condition_code::ne:
+				case condition_code::a:  return result != 0;
+				case condition_code::s:
+				case condition_code::l:  return result < 0;
+				case condition_code::ns:
+				case condition_code::ge: return result >= 0;
+				case condition_code::le: return result <= 0;
+				case condition_code::g:  return result > 0;
+				default:                 return std::nullopt;
+			}
+		}
+		return std::nullopt;
+	}
+
+	void record_comparison( basic_block* block, const instruction_info& insn, flag_operation op, const operand& lhs, const operand& rhs )
+	{
+		last_comparison = {
+			.block = block,
+			.next_vip = insn.address + insn.bytes.size(),
+			.op = op,
+			.lhs = lhs,
+			.rhs = rhs
+		};
+	}
+
+	bool has_comparison( const basic_block* block, uint64_t vip )
+	{
+		return last_comparison.block == block && last_comparison.next_vip == vip;
+	}
+
+	operative evaluate( basic_block* block, const instruction_info& insn, condition_code cc )
+	{
+		// The comparison is only usable by the instruction directly following it within the same
+		// block, the operands it refers to cannot have changed in between.
+		//
+		if ( has_comparison( block, insn.address ) )
+		{
+			if ( auto result = evaluate_fused( last_comparison, cc ) )
+				return *result;
+		}
+		return condition( cc );
+	}
+};
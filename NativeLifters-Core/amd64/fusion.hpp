@@ -0,0 +1,51 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include "amd64.hpp"
+#include "flags.hpp"
+
+// Fusion of comparisons with the condition evaluated by the instruction following them.
+// When a cmp or test is directly followed by a jcc, setcc or cmovcc, the condition is
+// computed from the compared operands instead of being rebuilt from the flags, which
+// gives the branch analysis a direct comparison to work with.
+//
+namespace vtil::lifter::amd64::flags
+{
+	// Records the operands of a comparison, op being sub for cmp and band for test.
+	//
+	void record_comparison( basic_block* block, const instruction_info& insn, flag_operation op, const operand& lhs, const operand& rhs );
+
+	// Checks if the instruction at the given address could be fused with the comparison preceding it.
+	//
+	bool has_comparison( const basic_block* block, uint64_t vip );
+
+	// Evaluates the condition for the given instruction, fusing it with the comparison
+	// preceding it if there is one.
+	//
+	operative evaluate( basic_block* block, const instruction_info& insn, condition_code cc );
+};
@@ -0,0 +1,233 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "lazy_flags.hpp"
+#include "flag_update.hpp"
+#include "../core/processing_flags.hpp"
+
+namespace vtil::lifter::amd64::flags
+{
+	// Flags pending materialization and the operation they are produced by.
+	//
+	struct deferred_flags
+	{
+		const basic_block* block = nullptr;
+		uint32_t pending = 0;
+
+		flag_operation op = add;
+		operand lhs;
+		operand rhs;
+		operand result;
+	};
+
+	// Returns the deferred flags of the given block, blocks are lifted one at a time
+	// per thread and have no pending flags left once they are terminated.
+	//
+	static deferred_flags& get_state( const basic_block* block )
+	{
+		static thread_local deferred_flags state = {};
+		if ( state.block != block )
+		{
+			fassert( !state.pending );
+			state = { .block = block };
+		}
+		return state;
+	}
+
+	// Effects of an instruction on each status flag as described by the decoder.
+	//
+	struct flag_effect
+	{
+		uint32_t mask;
+		uint64_t read;
+		uint64_t write;
+		uint64_t undefined;
+	};
+	static constexpr flag_effect flag_effects[] = {
+		{ cf_mask, X86_EFLAGS_TEST_CF | X86_EFLAGS_PRIOR_CF, X86_EFLAGS_MODIFY_CF | X86_EFLAGS_RESET_CF | X86_EFLAGS_SET_CF, X86_EFLAGS_UNDEFINED_CF },
+		{ pf_mask, X86_EFLAGS_TEST_PF | X86_EFLAGS_PRIOR_PF, X86_EFLAGS_MODIFY_PF | X86_EFLAGS_RESET_PF | X86_EFLAGS_SET_PF, X86_EFLAGS_UNDEFINED_PF },
+		{ af_mask, X86_EFLAGS_TEST_AF | X86_EFLAGS_PRIOR_AF, X86_EFLAGS_MODIFY_AF | X86_EFLAGS_RESET_AF | X86_EFLAGS_SET_AF, X86_EFLAGS_UNDEFINED_AF },
+		{ zf_mask, X86_EFLAGS_TEST_ZF | X86_EFLAGS_PRIOR_ZF, X86_EFLAGS_MODIFY_ZF | X86_EFLAGS_RESET_ZF | X86_EFLAGS_SET_ZF, X86_EFLAGS_UNDEFINED_ZF },
+		{ sf_mask, X86_EFLAGS_TEST_SF | X86_EFLAGS_PRIOR_SF, X86_EFLAGS_MODIFY_SF | X86_EFLAGS_RESET_SF | X86_EFLAGS_SET_SF, X86_EFLAGS_UNDEFINED_SF },
+		{ of_mask, X86_EFLAGS_TEST_OF | X86_EFLAGS_PRIOR_OF, X86_EFLAGS_MODIFY_OF | X86_EFLAGS_RESET_OF | X86_EFLAGS_SET_OF, X86_EFLAGS_UNDEFINED_OF },
+	};
+
+	// Instructions whose handlers defer the flags they produce. These overwrite every flag they
+	// modify, so the pending ones only have to be materialized if they are read.
+	//
+	static bool is_deferring( uint32_t id )
+	{
+		switch ( id )
+		{
+			case X86_INS_ADD:
+			case X86_INS_SUB:
+			case X86_INS_AND:
+			case X86_INS_OR:
+			case X86_INS_XOR:
+			case X86_INS_ADC:
+			case X86_INS_SBB:
+			case X86_INS_XADD:
+			case X86_INS_INC:
+			case X86_INS_DEC:
+			case X86_INS_CMP:
+			case X86_INS_TEST:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// Instructions that observe the flags register as a whole or that terminate the block.
+	//
+	static bool observes_all_flags( uint32_t id )
+	{
+		switch ( id )
+		{
+			case X86_INS_INVALID:
+			case X86_INS_PUSHF:
+			case X86_INS_PUSHFD:
+			case X86_INS_PUSHFQ:
+			case X86_INS_POPF:
+			case X86_INS_POPFD:
+			case X86_INS_POPFQ:
+			case X86_INS_LAHF:
+			case X86_INS_SAHF:
+				return true;
+			default:
+				return is_branch( id );
+		}
+	}
+
+	bool is_lazy( const basic_block* block )
+	{
+		return block->owner->context.get<processing_flags>().lazy_flags;
+	}
+
+	bool has_pending( const basic_block* block )
+	{
+		return is_lazy( block ) && get_state( block ).pending != 0;
+	}
+
+	void defer( basic_block* block, flag_operation op, const operand& lhs, const operand& rhs, const operand& result, uint32_t mask )
+	{
+		// Flags not overwritten by this operation still refer to the previous one.
+		//
+		materialize( block, ~mask );
+
+		// Snapshot any register that is not a temporary.
+		//
+		auto snapshot = [ & ] ( const operand& value ) -> operand
+		{
+			if ( !value.is_register() || value.reg().is_local() )
+				return value;
+			auto tmp = block->tmp( value.bit_count() );
+			block->mov( tmp, value );
+			return tmp;
+		};
+
+		auto& state = get_state( block );
+		state.pending = mask;
+		state.op = op;
+		state.lhs = snapshot( lhs );
+		state.rhs = snapshot( rhs );
+		state.result = snapshot( result );
+	}
+
+	void materialize( basic_block* block, uint32_t mask )
+	{
+		auto& state = get_state( block );
+		mask &= state.pending;
+		if ( !mask )
+			return;
+		state.pending &= ~mask;
+
+		operative lhs = state.lhs;
+		operative rhs = state.rhs;
+		operative result = state.result;
+
+		// Same computations process_flags would have emitted.
+		//
+		flag_update update = { block };
+		if ( mask & of_mask )
+		{
+			switch ( state.op )
+			{
+				case add:  update.set( OF, overflow<add>::flag( lhs, rhs, result ) );  break;
+				case sub:  update.set( OF, overflow<sub>::flag( lhs, rhs, result ) );  break;
+				case band: update.set( OF, overflow<band>::flag( lhs, rhs, result ) ); break;
+				case bor:  update.set( OF, overflow<bor>::flag( lhs, rhs, result ) );  break;
+				case bxor: update.set( OF, overflow<bxor>::flag( lhs, rhs, result ) ); break;
+				default:   unreachable();
+			}
+		}
+		if ( mask & cf_mask )
+		{
+			switch ( state.op )
+			{
+				case add:  update.set( CF, carry<add>::flag( lhs, rhs, result ) );  break;
+				case sub:  update.set( CF, carry<sub>::flag( lhs, rhs, result ) );  break;
+				case band: update.set( CF, carry<band>::flag( lhs, rhs, result ) ); break;
+				case bor:  update.set( CF, carry<bor>::flag( lhs, rhs, result ) );  break;
+				case bxor: update.set( CF, carry<bxor>::flag( lhs, rhs, result ) ); break;
+				default:   unreachable();
+			}
+		}
+		if ( mask & sf_mask ) update.set( SF, sign( result ) );
+		if ( mask & zf_mask ) update.set( ZF, zero( result ) );
+		if ( mask & af_mask ) update.set( AF, aux_carry( lhs, rhs, result ) );
+		if ( mask & pf_mask ) update.set( PF, parity( result ) );
+		update.emit();
+	}
+
+	void prepare( basic_block* block, const instruction_info& insn, bool is_handled )
+	{
+		auto& state = get_state( block );
+		if ( !state.pending )
+			return;
+
+		// Native code and the instructions observing all flags need them to be exact.
+		//
+		if ( !is_handled || observes_all_flags( insn.id ) )
+			return materialize( block );
+
+		uint32_t read = 0, touched = 0, undefined = 0;
+		for ( auto& effect : flag_effects )
+		{
+			if ( insn.eflags & effect.read )
+				read |= effect.mask;
+			if ( insn.eflags & ( effect.read | effect.write ) )
+				touched |= effect.mask;
+			if ( insn.eflags & effect.undefined )
+				undefined |= effect.mask;
+		}
+
+		// Handlers computing flags eagerly may read the ones they modify as well.
+		//
+		materialize( block, is_deferring( insn.id ) ? read : touched );
+		state.pending &= ~undefined;
+	}
+};
@@ -0,0 +1,73 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include "amd64.hpp"
+#include "flags.hpp"
+
+// Lazy evaluation of the status flags. Instead of computing every flag an arithmetic
+// instruction produces, the operation is recorded and the individual flags are only
+// computed once something observes them or the block ends.
+//
+namespace vtil::lifter::amd64::flags
+{
+	// Masks identifying the status flags that can be deferred.
+	//
+	enum status_mask : uint32_t
+	{
+		cf_mask =  1 << 0,
+		pf_mask =  1 << 1,
+		af_mask =  1 << 2,
+		zf_mask =  1 << 3,
+		sf_mask =  1 << 4,
+		of_mask =  1 << 5,
+		all_mask = cf_mask | pf_mask | af_mask | zf_mask | sf_mask | of_mask,
+	};
+
+	// Checks if the flags of the given block are evaluated lazily.
+	//
+	bool is_lazy( const basic_block* block );
+
+	// Records the operation producing the flags in the given mask instead of computing them,
+	// flags left pending by the previous operation are materialized first. Register operands
+	// are copied to temporaries since they may be overwritten before the flags are needed.
+	//
+	void defer( basic_block* block, flag_operation op, const operand& lhs, const operand& rhs, const operand& result, uint32_t mask = all_mask );
+
+	// Computes the pending flags in the given mask from the recorded operation.
+	//
+	void materialize( basic_block* block, uint32_t mask = all_mask );
+
+	// Checks if any flag of the given block is pending materialization.
+	//
+	bool has_pending( const basic_block* block );
+
+	// Brings the flags up to date for the given instruction before it is lifted: the flags it
+	// observes are materialized and the ones it only leaves undefined are dropped.
+	//
+	void prepare( basic_block* block, const instruction_info& insn, bool is_handled );
+};
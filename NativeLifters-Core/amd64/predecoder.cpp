@@ -0,0 +1,353 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "predecoder.hpp"
+#include <array>
+#include <algorithm>
+
+namespace vtil::lifter::amd64
+{
+	// Properties of each opcode relevant to the length of the instruction.
+	//
+	enum opcode_flags : uint16_t
+	{
+		op_modrm =   1 << 0,
+		op_imm8 =    1 << 1,
+		op_imm16 =   1 << 2,
+		op_imm32 =   1 << 3,
+		op_immz =    1 << 4,  // 16 or 32 bits depending on the operand size.
+		op_immv =    1 << 5,  // 16, 32 or 64 bits depending on the operand size.
+		op_moffs =   1 << 6,  // 32 or 64 bits depending on the address size.
+		op_group3 =  1 << 7,  // Immediate only present for /0 and /1.
+		op_invalid = 1 << 8,
+	};
+	using opcode_table = std::array<uint16_t, 256>;
+
+	static constexpr void set_range( opcode_table& table, size_t first, size_t last, uint16_t flags )
+	{
+		for ( size_t i = first; i <= last; i++ )
+			table[ i ] |= flags;
+	}
+
+	// Primary opcode map.
+	//
+	static constexpr opcode_table primary_table = [ ] ()
+	{
+		opcode_table table = {};
+
+		// Arithmetic rows, r/m forms followed by the accumulator forms.
+		//
+		for ( size_t row = 0x00; row <= 0x38; row += 8 )
+		{
+			set_range( table, row, row + 3, op_modrm );
+			table[ row + 4 ] |= op_imm8;
+			table[ row + 5 ] |= op_immz;
+		}
+
+		// Opcodes that are not encodable in 64-bit mode.
+		//
+		for ( size_t op : { 0x06, 0x07, 0x0E, 0x16, 0x17, 0x1E, 0x1F, 0x27, 0x2F, 0x37, 0x3F,
+							0x60, 0x61, 0x82, 0x9A, 0xCE, 0xD4, 0xD5, 0xD6, 0xEA } )
+			table[ op ] = op_invalid;
+
+		table[ 0x63 ] |= op_modrm;
+		table[ 0x68 ] |= op_immz;
+		table[ 0x69 ] |= op_modrm | op_immz;
+		table[ 0x6A ] |= op_imm8;
+		table[ 0x6B ] |= op_modrm | op_imm8;
+		set_range( table, 0x70, 0x7F, op_imm8 );
+		table[ 0x80 ] |= op_modrm | op_imm8;
+		table[ 0x81 ] |= op_modrm | op_immz;
+		table[ 0x83 ] |= op_modrm | op_imm8;
+		set_range( table, 0x84, 0x8F, op_modrm );
+		set_range( table, 0xA0, 0xA3, op_moffs );
+		table[ 0xA8 ] |= op_imm8;
+		table[ 0xA9 ] |= op_immz;
+		set_range( table, 0xB0, 0xB7, op_imm8 );
+		set_range( table, 0xB8, 0xBF, op_immv );
+		table[ 0xC0 ] |= op_modrm | op_imm8;
+		table[ 0xC1 ] |= op_modrm | op_imm8;
+		table[ 0xC2 ] |= op_imm16;
+		table[ 0xC6 ] |= op_modrm | op_imm8;
+		table[ 0xC7 ] |= op_modrm | op_immz;
+		table[ 0xC8 ] |= op_imm16 | op_imm8;
+		table[ 0xCA ] |= op_imm16;
+		table[ 0xCD ] |= op_imm8;
+		set_range( table, 0xD0, 0xD3, op_modrm );
+		set_range( table, 0xD8, 0xDF, op_modrm );
+		set_range( table, 0xE0, 0xE7, op_imm8 );
+		table[ 0xE8 ] |= op_imm32;
+		table[ 0xE9 ] |= op_imm32;
+		table[ 0xEB ] |= op_imm8;
+		table[ 0xF6 ] |= op_modrm | op_group3;
+		table[ 0xF7 ] |= op_modrm | op_group3;
+		table[ 0xFE ] |= op_modrm;
+		table[ 0xFF ] |= op_modrm;
+		return table;
+	}();
+
+	// Secondary (0F) opcode map, also used for VEX/EVEX map 1.
+	//
+	static constexpr opcode_table secondary_table = [ ] ()
+	{
+		opcode_table table = {};
+		set_range( table, 0x00, 0xFF, op_modrm );
+
+		// Opcodes without a ModR/M byte.
+		//
+		for ( size_t op : { 0x05, 0x06, 0x07, 0x08, 0x09, 0x0B, 0x0E, 0x77, 0xA0, 0xA1, 0xA2, 0xA8, 0xA9, 0xAA } )
+			table[ op ] &= ~op_modrm;
+		for ( size_t op = 0x30; op <= 0x37; op++ )
+			table[ op ] &= ~op_modrm;
+		for ( size_t op = 0xC8; op <= 0xCF; op++ )
+			table[ op ] &= ~op_modrm;
+
+		// Near conditional branches.
+		//
+		for ( size_t op = 0x80; op <= 0x8F; op++ )
+			table[ op ] = op_imm32;
+
+		// Opcodes with an 8-bit immediate, 0F 0F is the 3DNow! escape which has
+		// its opcode encoded as a trailing byte.
+		//
+		for ( size_t op : { 0x0F, 0x70, 0x71, 0x72, 0x73, 0xA4, 0xAC, 0xBA, 0xC2, 0xC4, 0xC5, 0xC6 } )
+			table[ op ] |= op_imm8;
+
+		// Undefined opcodes.
+		//
+		for ( size_t op : { 0x04, 0x0A, 0x0C, 0x24, 0x25, 0x26, 0x27, 0x36, 0x39, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F, 0x7A, 0x7B, 0xA6, 0xA7 } )
+			table[ op ] = op_invalid;
+		return table;
+	}();
+
+	// Opcode maps selectable through VEX, EVEX and XOP prefixes.
+	//
+	enum class opcode_map
+	{
+		primary,
+		secondary,
+		map_0f38,
+		map_0f3a,
+		xop_8,
+		xop_9,
+		xop_a,
+	};
+
+	// Returns the number of bytes occupied by the ModR/M byte and everything it implies,
+	// or zero if the encoding exceeds the given limit.
+	//
+	static size_t modrm_length( const uint8_t* code, size_t left )
+	{
+		if ( left < 1 ) return 0;
+		uint8_t mod = code[ 0 ] >> 6;
+		uint8_t rm = code[ 0 ] & 7;
+		if ( mod == 3 ) return 1;
+
+		size_t length = 1;
+		if ( rm == 4 )
+		{
+			if ( left < 2 ) return 0;
+			if ( mod == 0 && ( code[ 1 ] & 7 ) == 5 )
+				length += 4;
+			length++;
+		}
+		else if ( mod == 0 && rm == 5 )
+		{
+			length += 4;
+		}
+
+		if ( mod == 1 ) length += 1;
+		else if ( mod == 2 ) length += 4;
+		return length <= left ? length : 0;
+	}
+
+	length_info predecode( uint64_t vip, const uint8_t* code, size_t max_length )
+	{
+		constexpr size_t max_instruction_length = 15;
+		const size_t limit = std::min( max_length, max_instruction_length );
+
+		length_info result = {};
+		size_t n = 0;
+
+		// Consume legacy prefixes and REX, a REX prefix is only effective if it directly precedes the opcode.
+		//
+		bool opsize16 = false;
+		bool addrsize32 = false;
+		bool rex_w = false;
+		while ( n < limit )
+		{
+			uint8_t byte = code[ n ];
+			if ( byte == 0x66 )                    opsize16 = true, rex_w = false;
+			else if ( byte == 0x67 )               addrsize32 = true, rex_w = false;
+			else if ( byte == 0xF0 || byte == 0xF2 || byte == 0xF3 ||
+					  byte == 0x26 || byte == 0x2E || byte == 0x36 ||
+					  byte == 0x3E || byte == 0x64 || byte == 0x65 ) rex_w = false;
+			else if ( ( byte & 0xF0 ) == 0x40 )    rex_w = ( byte & 8 ) != 0;
+			else                                   break;
+			n++;
+		}
+		if ( n >= limit ) return {};
+
+		// Determine the opcode map.
+		//
+		opcode_map map = opcode_map::primary;
+		uint8_t opcode = code[ n++ ];
+		bool modrm_forced = false;
+		if ( opcode == 0x0F )
+		{
+			if ( n >= limit ) return {};
+			opcode = code[ n++ ];
+			map = opcode_map::secondary;
+			if ( opcode == 0x38 || opcode == 0x3A )
+			{
+				if ( n >= limit ) return {};
+				map = opcode == 0x38 ? opcode_map::map_0f38 : opcode_map::map_0f3a;
+				opcode = code[ n++ ];
+			}
+		}
+		else if ( opcode == 0xC4 || opcode == 0xC5 || opcode == 0x62 ||
+				  ( opcode == 0x8F && n < limit && ( code[ n ] & 0x38 ) != 0 ) )
+		{
+			// VEX, EVEX and XOP prefixes, all of which imply a ModR/M byte.
+			//
+			bool is_evex = opcode == 0x62;
+			size_t prefix_length = opcode == 0xC5 ? 1 : is_evex ? 3 : 2;
+			if ( n + prefix_length >= limit ) return {};
+
+			uint8_t select = opcode == 0xC5 ? 1 : ( code[ n ] & ( is_evex ? 0x07 : 0x1F ) );
+			if ( opcode == 0x8F )
+			{
+				if ( select == 8 )       map = opcode_map::xop_8;
+				else if ( select == 9 )  map = opcode_map::xop_9;
+				else if ( select == 10 ) map = opcode_map::xop_a;
+				else                     return {};
+			}
+			else
+			{
+				if ( select == 1 )       map = opcode_map::secondary;
+				else if ( select == 2 )  map = opcode_map::map_0f38;
+				else if ( select == 3 )  map = opcode_map::map_0f3a;
+				else                     return {};
+			}
+			if ( opcode != 0xC5 )
+				rex_w = ( code[ n + 1 ] & 0x80 ) != 0;
+
+			n += prefix_length;
+			opcode = code[ n++ ];
+
+			// VZEROUPPER and VZEROALL are the only VEX encoded instructions without ModR/M.
+			//
+			modrm_forced = is_evex || !( map == opcode_map::secondary && opcode == 0x77 );
+		}
+
+		// Look up the opcode properties.
+		//
+		uint16_t flags;
+		switch ( map )
+		{
+			case opcode_map::primary:   flags = primary_table[ opcode ];                                       break;
+			case opcode_map::secondary: flags = secondary_table[ opcode ];                                     break;
+			case opcode_map::map_0f38:  flags = op_modrm;                                                      break;
+			case opcode_map::map_0f3a:  flags = op_modrm | op_imm8;                                            break;
+			case opcode_map::xop_8:     flags = op_modrm | op_imm8;                                            break;
+			case opcode_map::xop_9:     flags = op_modrm;                                                      break;
+			case opcode_map::xop_a:     flags = op_modrm | op_imm32;                                           break;
+			default:                    return {};
+		}
+		if ( flags & op_invalid ) return {};
+		if ( modrm_forced ) flags |= op_modrm;
+
+		// Skip the ModR/M, SIB and displacement bytes.
+		//
+		uint8_t modrm_reg = 0;
+		if ( flags & op_modrm )
+		{
+			size_t length = modrm_length( code + n, limit - n );
+			if ( !length ) return {};
+			modrm_reg = ( code[ n ] >> 3 ) & 7;
+			n += length;
+		}
+
+		// Determine the size of the immediate.
+		//
+		size_t imm_size = 0;
+		if ( flags & op_imm8 )  imm_size += 1;
+		if ( flags & op_imm16 ) imm_size += 2;
+		if ( flags & op_imm32 ) imm_size += 4;
+		if ( flags & op_immz )  imm_size += opsize16 && !rex_w ? 2 : 4;
+		if ( flags & op_immv )  imm_size += rex_w ? 8 : opsize16 ? 2 : 4;
+		if ( flags & op_moffs ) imm_size += addrsize32 ? 4 : 8;
+		if ( ( flags & op_group3 ) && modrm_reg <= 1 )
+			imm_size += ( opcode & 1 ) ? ( opsize16 && !rex_w ? 2 : 4 ) : 1;
+
+		n += imm_size;
+		if ( n > limit ) return {};
+		result.length = ( uint8_t ) n;
+
+		// Classify the control flow.
+		//
+		auto relative_target = [ & ] ()
+		{
+			int64_t displacement = imm_size == 1
+				? ( int64_t ) ( int8_t ) code[ n - 1 ]
+				: ( int64_t ) ( int32_t ) ( code[ n - 4 ] | ( code[ n - 3 ] << 8 ) | ( code[ n - 2 ] << 16 ) | ( uint32_t( code[ n - 1 ] ) << 24 ) );
+			return vip + n + displacement;
+		};
+
+		if ( map == opcode_map::primary )
+		{
+			if ( ( 0x70 <= opcode && opcode <= 0x7F ) || ( 0xE0 <= opcode && opcode <= 0xE3 ) )
+			{
+				result.is_branch = true;
+				result.is_conditional = true;
+				result.target = relative_target();
+			}
+			else if ( opcode == 0xEB || opcode == 0xE9 || opcode == 0xE8 )
+			{
+				result.is_branch = true;
+				result.is_call = opcode == 0xE8;
+				result.target = relative_target();
+			}
+			else if ( opcode == 0xC2 || opcode == 0xC3 || opcode == 0xCA || opcode == 0xCB || opcode == 0xCF )
+			{
+				result.is_branch = true;
+			}
+			else if ( opcode == 0xFF && 2 <= modrm_reg && modrm_reg <= 5 )
+			{
+				result.is_branch = true;
+				result.is_call = modrm_reg <= 3;
+			}
+		}
+		else if ( map == opcode_map::secondary && ( flags & op_imm32 ) && !modrm_forced )
+		{
+			result.is_branch = true;
+			result.is_conditional = true;
+			result.target = relative_target();
+		}
+		return result;
+	}
+};
@@ -0,0 +1,62 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <cstdint>
+#include <optional>
+
+namespace vtil::lifter::amd64
+{
+	// Describes an instruction as seen by the length pre-decoder, which only looks at
+	// the encoding and is used to sweep code much faster than the disassembler can.
+	//
+	struct length_info
+	{
+		// Length of the instruction, zero if it could not be decoded.
+		//
+		uint8_t length = 0;
+
+		// Control flow properties.
+		//
+		bool is_branch = false;
+		bool is_conditional = false;
+		bool is_call = false;
+
+		// Destination of the branch if it is encoded as a relative immediate.
+		//
+		std::optional<uint64_t> target;
+
+		// Checks if execution can continue at the next instruction.
+		//
+		bool has_fallthrough() const { return !is_branch || is_conditional || is_call; }
+	};
+
+	// Determines the length and the branch properties of the 64-bit mode instruction at
+	// the given address, reading at most max_length bytes.
+	//
+	length_info predecode( uint64_t vip, const uint8_t* code, size_t max_length );
+};
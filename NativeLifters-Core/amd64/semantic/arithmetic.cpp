@@ -27,6 +27,8 @@
 //
 #include "../amd64.hpp"
 #include "../flags.hpp"
+#include "../lazy_flags.hpp"
+#include "../flag_update.hpp"
 
 // Various x86 arithmetic instructions.
 // 
@@ -37,20 +39,24 @@ namespace vtil::lifter::amd64
 	template<flags::flag_operation op>
 	void process_flags( basic_block *block, const operand &lhs, const operand &rhs, const operand &result )
 	{
-		block
-			->mov( flags::OF, flags::overflow< op >::flag( lhs, rhs, result ))
-			->mov( flags::CF, flags::carry< op >::flag( lhs, rhs, result ))
-			->mov( flags::SF, flags::sign( result ))
-			->mov( flags::ZF, flags::zero( result ))
-			->mov( flags::AF, flags::aux_carry( lhs, rhs, result ))
-			->mov( flags::PF, flags::parity( result ));
+		if ( flags::is_lazy( block ) )
+			return flags::defer( block, op, lhs, rhs, result );
+
+		flags::flag_update( block )
+			.set( flags::OF, flags::overflow< op >::flag( lhs, rhs, result ))
+			.set( flags::CF, flags::carry< op >::flag( lhs, rhs, result ))
+			.set( flags::SF, flags::sign( result ))
+			.set( flags::ZF, flags::zero( result ))
+			.set( flags::AF, flags::aux_carry( lhs, rhs, result ))
+			.set( flags::PF, flags::parity( result ))
+			.emit();
 	}
 
 // List of handlers.
 //
 	// Because SHL and SAL are equivalent, they share this handler
 	//
-	static auto shl_handler =
+	static constexpr auto shl_handler =
 	[]( basic_block *block, const instruction_info &insn )
 	{
 		auto lhs = operative( load_operand( block, insn, 0 ));
@@ -65,25 +71,27 @@ namespace vtil::lifter::amd64
 		// Temp var to set OF to ?UD in case of multibit shift 
 		auto undef = __if(shft_amt > 1, operative(UNDEFINED)) & 1;
 
-		block
-			->bxor(flags::CF, (shft_amt != 0) & (operative(flags::CF) ^ ((lhs >> lbso_pos) & 1)))
-			->bxor(flags::OF, (shft_amt != 0) & (operative(flags::OF) ^ (flags::sign({ result }) ^ lhs_sign)))
-			->add(flags::OF, undef)
-			->bxor( flags::SF, (shft_amt != 0 ) & ( operative( flags::SF ) ^ flags::sign( result )))
-			->bxor( flags::ZF, (shft_amt != 0 ) & ( operative( flags::ZF ) ^ flags::zero( result )))
-			->bxor( flags::PF, (shft_amt != 0 ) & ( operative( flags::PF ) ^ flags::parity( result )));
+		flags::flag_update( block )
+			.set_if( flags::CF, shft_amt != 0, ( lhs >> lbso_pos ) & 1 )
+			.set_if( flags::OF, shft_amt != 0, flags::sign( { result } ) ^ lhs_sign )
+			.toggle(flags::OF, undef)
+			.set_if( flags::SF, shft_amt != 0, flags::sign( result ) )
+			.set_if( flags::ZF, shft_amt != 0, flags::zero( result ) )
+			.set_if( flags::PF, shft_amt != 0, flags::parity( result ) )
+			.emit();
 
 		store_operand( block, insn, 0, result );
 	};
 
-	handler_map_t arithmetic_handlers =
+	static constexpr handler_entry arithmetic_handler_list[] =
 		{
 			{
 				X86_INS_ADC,
-				[]( basic_block *block, const instruction_info &insn )
+				shape_dispatch<[]( auto shape, basic_block *block, const instruction_info &insn )
 				{
-					auto lhs = load_operand( block, insn, 0 );
-					auto rhs = load_operand( block, insn, 1 );
+					using shape_t = decltype( shape );
+					auto lhs = load_operand<shape_t::destination>( block, insn.operands[ 0 ] );
+					auto rhs = load_operand<shape_t::source>( block, insn.operands[ 1 ] );
 
 					auto tmp = block->tmp( lhs.bit_count());
 
@@ -94,8 +102,8 @@ namespace vtil::lifter::amd64
 
 					process_flags< flags::flag_operation::add >( block, lhs, rhs, tmp );
 
-					store_operand( block, insn, 0, { tmp } );
-				}
+					store_operand<shape_t::destination>( block, insn.operands[ 0 ], { tmp } );
+				}>
 			},
 			{
 				X86_INS_AAA,
@@ -185,10 +193,11 @@ namespace vtil::lifter::amd64
 			},
 			{
 				X86_INS_SBB,
-				[]( basic_block *block, const instruction_info &insn )
+				shape_dispatch<[]( auto shape, basic_block *block, const instruction_info &insn )
 				{
-					auto lhs = load_operand( block, insn, 0 );
-					auto rhs = load_operand( block, insn, 1 );
+					using shape_t = decltype( shape );
+					auto lhs = load_operand<shape_t::destination>( block, insn.operands[ 0 ] );
+					auto rhs = load_operand<shape_t::source>( block, insn.operands[ 1 ] );
 
 					auto tmp = block->tmp( lhs.bit_count());
 
@@ -199,8 +208,8 @@ namespace vtil::lifter::amd64
 
 					process_flags< flags::flag_operation::sub >( block, lhs, rhs, tmp );
 
-					store_operand( block, insn, 0, { tmp } );
-				}
+					store_operand<shape_t::destination>( block, insn.operands[ 0 ], { tmp } );
+				}>
 			},
 			{
 				X86_INS_MUL,
@@ -244,21 +253,11 @@ namespace vtil::lifter::amd64
 								->mov( hi, X86_REG_EAX )
 								->mul( lo, rhs )
 								->mulhi( hi, rhs )
-								->mov( X86_REG_EAX, lo )
-								->mov( X86_REG_EDX, hi )
+								->mov( X86_REG_RAX, lo )
+								->mov( X86_REG_RDX, hi )
 								->tne( flags::CF, hi, 0 )
 								->tne( flags::OF, hi, 0 );
 
-							operand op_eax = register_cast<x86_reg>{}(X86_REG_EAX);
-							operand op_edx = register_cast<x86_reg>{}(X86_REG_EDX);
-
-							op_eax.reg().bit_offset += 32;
-							op_edx.reg().bit_offset += 32;
-
-							block
-								->mov(op_eax, 0ull)
-								->mov(op_edx, 0ull);
-
 							break;
 						}
 
@@ -326,21 +325,11 @@ namespace vtil::lifter::amd64
 										->mov( hi, X86_REG_EAX )
 										->imul( lo, rhs )
 										->imulhi( hi, rhs )
-										->mov( X86_REG_EAX, lo )
-										->mov( X86_REG_EDX, hi )
+										->mov( X86_REG_RAX, lo )
+										->mov( X86_REG_RDX, hi )
 										->tne( flags::CF, hi, 0 )
 										->tne( flags::OF, hi, 0 );
 
-									operand op_eax = register_cast<x86_reg>{}(X86_REG_EAX);									
-									operand op_edx = register_cast<x86_reg>{}(X86_REG_EDX);
-
-									op_eax.reg().bit_offset += 32;
-									op_edx.reg().bit_offset += 32;
-
-									block
-										->mov(op_eax, 0ull)
-										->mov(op_edx, 0ull);
-
 									break;
 								}
 
@@ -407,13 +396,14 @@ namespace vtil::lifter::amd64
 				{
 					auto op = load_operand( block, insn, 0 );
 
-					block
-						->mov( flags::CF, UNDEFINED )
-						->mov( flags::OF, UNDEFINED )
-						->mov( flags::PF, UNDEFINED )
-						->mov( flags::AF, UNDEFINED )
-						->mov( flags::ZF, UNDEFINED )
-						->mov( flags::SF, UNDEFINED );
+					flags::flag_update( block )
+						.set( flags::CF, operative( UNDEFINED ) )
+						.set( flags::OF, operative( UNDEFINED ) )
+						.set( flags::PF, operative( UNDEFINED ) )
+						.set( flags::AF, operative( UNDEFINED ) )
+						.set( flags::ZF, operative( UNDEFINED ) )
+						.set( flags::SF, operative( UNDEFINED ) )
+						.emit();
 
 					switch ( op.size())
 					{
@@ -454,18 +444,8 @@ namespace vtil::lifter::amd64
 								->mov( t2, t1 )
 								->div( t1, t0, op )
 								->rem( t2, t0, op )
-								->mov( X86_REG_EAX, t1 )
-								->mov( X86_REG_EDX, t2 );
-
-							operand op_eax = register_cast<x86_reg>{}(X86_REG_EAX);
-							operand op_edx = register_cast<x86_reg>{}(X86_REG_EDX);
-
-							op_eax.reg().bit_offset += 32;
-							op_edx.reg().bit_offset += 32;
-
-							block
-								->mov(op_eax, 0ull)
-								->mov(op_edx, 0ull);
+								->mov( X86_REG_RAX, t1 )
+								->mov( X86_REG_RDX, t2 );
 							break;
 						}
 
@@ -491,13 +471,14 @@ namespace vtil::lifter::amd64
 				{
 					auto op = load_operand( block, insn, 0 );
 
-					block
-						->mov( flags::CF, UNDEFINED )
-						->mov( flags::OF, UNDEFINED )
-						->mov( flags::PF, UNDEFINED )
-						->mov( flags::AF, UNDEFINED )
-						->mov( flags::ZF, UNDEFINED )
-						->mov( flags::SF, UNDEFINED );
+					flags::flag_update( block )
+						.set( flags::CF, operative( UNDEFINED ) )
+						.set( flags::OF, operative( UNDEFINED ) )
+						.set( flags::PF, operative( UNDEFINED ) )
+						.set( flags::AF, operative( UNDEFINED ) )
+						.set( flags::ZF, operative( UNDEFINED ) )
+						.set( flags::SF, operative( UNDEFINED ) )
+						.emit();
 
 					switch ( op.size())
 					{
@@ -538,18 +519,8 @@ namespace vtil::lifter::amd64
 								->mov( t2, t1 )
 								->idiv( t1, t0, op )
 								->irem( t2, t0, op )
-								->mov( X86_REG_EAX, t1 )
-								->mov( X86_REG_EDX, t2 );
-
-							operand op_eax = register_cast<x86_reg>{}(X86_REG_EAX);
-							operand op_edx = register_cast<x86_reg>{}(X86_REG_EDX);
-
-							op_eax.reg().bit_offset += 32;
-							op_edx.reg().bit_offset += 32;
-
-							block
-								->mov(op_eax, 0ull)
-								->mov(op_edx, 0ull);
+								->mov( X86_REG_RAX, t1 )
+								->mov( X86_REG_RDX, t2 );
 							break;
 						}
 
@@ -591,12 +562,13 @@ namespace vtil::lifter::amd64
 
 					auto result = ( operative( lhs ) >> ( operative( rhs ) & ( lhs.size() == 8 ? 0x3F : 0x1F ))).op;
 
-					block
-						->bxor( flags::CF, ( rhs != 0 ) & ( operative( flags::CF ) ^ ( operative( lhs ) & 1 )))
-						->bxor( flags::OF, ( rhs != 0 ) & ( operative( flags::OF ) ^ flags::sign( { lhs } )))
-						->bxor( flags::SF, ( rhs != 0 ) & ( operative( flags::SF ) ^ flags::sign( result )))
-						->bxor( flags::ZF, ( rhs != 0 ) & ( operative( flags::ZF ) ^ flags::zero( result )))
-						->bxor( flags::PF, ( rhs != 0 ) & ( operative( flags::PF ) ^ flags::parity( result )));
+					flags::flag_update( block )
+						.set_if( flags::CF, rhs != 0, operative( lhs ) & 1 )
+						.set_if( flags::OF, rhs != 0, flags::sign( { lhs } ) )
+						.set_if( flags::SF, rhs != 0, flags::sign( result ) )
+						.set_if( flags::ZF, rhs != 0, flags::zero( result ) )
+						.set_if( flags::PF, rhs != 0, flags::parity( result ) )
+						.emit();
 
 					store_operand( block, insn, 0, result );
 				}
@@ -610,12 +582,13 @@ namespace vtil::lifter::amd64
 
 					auto result = (( lhs >> ( rhs & ( lhs.op.size() == 8 ? 0x3F : 0x1F ))) | ( lhs & ( 1ULL << ( lhs.op.bit_count() - 1 )))).op;
 
-					block
-						->bxor( flags::CF, ( rhs != 0 ) & ( operative( flags::CF ) ^ ( lhs & 1 )))
-						->bxor( flags::OF, ( rhs != 0 ) & operative( flags::OF ))
-						->bxor( flags::SF, ( rhs != 0 ) & ( operative( flags::SF ) ^ flags::sign( result )))
-						->bxor( flags::ZF, ( rhs != 0 ) & ( operative( flags::ZF ) ^ flags::zero( result )))
-						->bxor( flags::PF, ( rhs != 0 ) & ( operative( flags::PF ) ^ flags::parity( result )));
+					flags::flag_update( block )
+						.set_if( flags::CF, rhs != 0, lhs & 1 )
+						.set_if( flags::OF, rhs != 0, 0 )
+						.set_if( flags::SF, rhs != 0, flags::sign( result ) )
+						.set_if( flags::ZF, rhs != 0, flags::zero( result ) )
+						.set_if( flags::PF, rhs != 0, flags::parity( result ) )
+						.emit();
 
 					store_operand( block, insn, 0, result );
 				}
@@ -635,12 +608,13 @@ namespace vtil::lifter::amd64
 					// last bit shifted out position
 					auto lbso_pos = operative(o1.bit_count()) - count;
 
-					block
-						->bxor( flags::CF, ( count != 0 ) & ( operative( flags::CF ) ^ ( (operative( o1 ) >> lbso_pos) & 1 ) ) )
-						->bxor( flags::OF, ( count != 0 ) & ( operative( flags::OF ) ^ ( flags::sign( { result } ) ^ lhs_sign ) ) )
-						->bxor( flags::SF, ( count != 0 ) & ( operative( flags::SF ) ^ flags::sign( result ) ) )
-						->bxor( flags::ZF, ( count != 0 ) & ( operative( flags::ZF ) ^ flags::zero( result ) ) )
-						->bxor( flags::PF, ( count != 0 ) & ( operative( flags::PF ) ^ flags::parity( result ) ) );
+					flags::flag_update( block )
+						.set_if( flags::CF, count != 0, ( operative( o1 ) >> lbso_pos ) & 1 )
+						.set_if( flags::OF, count != 0, flags::sign( { result } ) ^ lhs_sign )
+						.set_if( flags::SF, count != 0, flags::sign( result ) )
+						.set_if( flags::ZF, count != 0, flags::zero( result ) )
+						.set_if( flags::PF, count != 0, flags::parity( result ) )
+						.emit();
 
 					store_operand( block, insn, 0, result );
 				}
@@ -659,12 +633,13 @@ namespace vtil::lifter::amd64
 					// last bit shifted out position
 					auto lbso_pos = count - operative(1);
 
-					block
-						->bxor( flags::CF, ( count != 0 ) & ( operative( flags::CF ) ^ ( (operative( o1 ) >> lbso_pos) & 1 ) ) )
-						->bxor( flags::OF, ( count != 0 ) & ( operative( flags::OF ) ^ flags::sign( { o1 } ) ) )
-						->bxor( flags::SF, ( count != 0 ) & ( operative( flags::SF ) ^ flags::sign( result ) ) )
-						->bxor( flags::ZF, ( count != 0 ) & ( operative( flags::ZF ) ^ flags::zero( result ) ) )
-						->bxor( flags::PF, ( count != 0 ) & ( operative( flags::PF ) ^ flags::parity( result ) ) );
+					flags::flag_update( block )
+						.set_if( flags::CF, count != 0, ( operative( o1 ) >> lbso_pos ) & 1 )
+						.set_if( flags::OF, count != 0, flags::sign( { o1 } ) )
+						.set_if( flags::SF, count != 0, flags::sign( result ) )
+						.set_if( flags::ZF, count != 0, flags::zero( result ) )
+						.set_if( flags::PF, count != 0, flags::parity( result ) )
+						.emit();
 
 					store_operand( block, insn, 0, result );
 				}
@@ -744,12 +719,20 @@ namespace vtil::lifter::amd64
 					auto lhs = operative( load_operand( block, insn, 0 ));
 					auto result = lhs + 1;
 
-					block
-						->mov( flags::AF, flags::aux_carry( lhs, { 1 }, result ))
-						->mov( flags::OF, flags::overflow< flags::add >::flag( lhs, { 1 }, result ))
-						->mov( flags::SF, flags::sign( result ))
-						->mov( flags::ZF, flags::zero( result ))
-						->mov( flags::PF, flags::parity( result ));
+					if ( flags::is_lazy( block ) )
+					{
+						flags::defer( block, flags::add, lhs.op, operative( 1 ).op, result.op, flags::all_mask & ~flags::cf_mask );
+					}
+					else
+					{
+						flags::flag_update( block )
+							.set( flags::AF, flags::aux_carry( lhs, { 1 }, result ))
+							.set( flags::OF, flags::overflow< flags::add >::flag( lhs, { 1 }, result ))
+							.set( flags::SF, flags::sign( result ))
+							.set( flags::ZF, flags::zero( result ))
+							.set( flags::PF, flags::parity( result ))
+							.emit();
+					}
 
 					store_operand( block, insn, 0, result );
 				}
@@ -761,12 +744,20 @@ namespace vtil::lifter::amd64
 					auto lhs = operative( load_operand( block, insn, 0 ));
 					auto result = lhs - 1;
 
-					block
-						->mov( flags::AF, flags::aux_carry( lhs, { -1 }, result ))
-						->mov( flags::OF, flags::overflow< flags::sub >::flag( lhs, { -1 }, result ))
-						->mov( flags::SF, flags::sign( result ))
-						->mov( flags::ZF, flags::zero( result ))
-						->mov( flags::PF, flags::parity( result ));
+					if ( flags::is_lazy( block ) )
+					{
+						flags::defer( block, flags::sub, lhs.op, operative( -1 ).op, result.op, flags::all_mask & ~flags::cf_mask );
+					}
+					else
+					{
+						flags::flag_update( block )
+							.set( flags::AF, flags::aux_carry( lhs, { -1 }, result ))
+							.set( flags::OF, flags::overflow< flags::sub >::flag( lhs, { -1 }, result ))
+							.set( flags::SF, flags::sign( result ))
+							.set( flags::ZF, flags::zero( result ))
+							.set( flags::PF, flags::parity( result ))
+							.emit();
+					}
 
 					store_operand( block, insn, 0, result );
 				}
@@ -778,13 +769,14 @@ namespace vtil::lifter::amd64
 					auto lhs = operative( load_operand( block, insn, 0 ));
 					auto result = 0 - lhs;
 
-					block
-						->mov( flags::CF, ( lhs != 0 ))
-						->mov( flags::AF, flags::aux_carry( { 0 }, lhs, result ))
-						->mov( flags::OF, flags::overflow< flags::sub >::flag( { 0 }, lhs, result ))
-						->mov( flags::SF, flags::sign( result ))
-						->mov( flags::ZF, flags::zero( result ))
-						->mov( flags::PF, flags::parity( result ));
+					flags::flag_update( block )
+						.set( flags::CF, ( lhs != 0 ))
+						.set( flags::AF, flags::aux_carry( { 0 }, lhs, result ))
+						.set( flags::OF, flags::overflow< flags::sub >::flag( { 0 }, lhs, result ))
+						.set( flags::SF, flags::sign( result ))
+						.set( flags::ZF, flags::zero( result ))
+						.set( flags::PF, flags::parity( result ))
+						.emit();
 
 					store_operand( block, insn, 0, result );
 				}
@@ -919,20 +911,21 @@ namespace vtil::lifter::amd64
 			DEFINE_CXE( X86_INS_CWDE, X86_REG_AX, X86_REG_EAX ),
 			DEFINE_CXE( X86_INS_CDQE, X86_REG_EAX, X86_REG_RAX ),
 
-			// Binop generics
+			// Binop generics, specialized per operand shape.
 			//
-#define DEFINE_BINOP( mnemonic, name, op )                                    \
-        {                                                                            \
-            mnemonic,                                                                \
-            [ ] ( basic_block* block, const instruction_info& insn )                \
-            {                                                                        \
-                auto lhs = load_operand( block, insn, 0 );                          \
-                auto rhs = load_operand( block, insn, 1 );                          \
-                auto tmp = block->tmp( lhs.bit_count() );                           \
-                block->mov( tmp, lhs )->op( tmp, rhs );                             \
-                process_flags<flags::flag_operation::op>( block, lhs, rhs, tmp ); \
-                store_operand( block, insn, 0, tmp );                               \
-            }                                                                        \
+#define DEFINE_BINOP( mnemonic, name, op )                                                      \
+        {                                                                                              \
+            mnemonic,                                                                                  \
+            shape_dispatch<[ ] ( auto shape, basic_block* block, const instruction_info& insn )     \
+            {                                                                                          \
+                using shape_t = decltype( shape );                                                     \
+                auto lhs = load_operand<shape_t::destination>( block, insn.operands[ 0 ] );           \
+                auto rhs = load_operand<shape_t::source>( block, insn.operands[ 1 ] );                \
+                auto tmp = block->tmp( lhs.bit_count() );                                             \
+                block->mov( tmp, lhs )->op( tmp, rhs );                                               \
+                process_flags<flags::flag_operation::op>( block, lhs, rhs, tmp );                   \
+                store_operand<shape_t::destination>( block, insn.operands[ 0 ], tmp );                \
+            }>                                                                                         \
         }
 			DEFINE_BINOP( X86_INS_ADD, add, add ),
 			DEFINE_BINOP( X86_INS_SUB, sub, sub ),
@@ -940,4 +933,7 @@ namespace vtil::lifter::amd64
 			DEFINE_BINOP( X86_INS_XOR, xor, bxor ),
 			DEFINE_BINOP( X86_INS_OR, or, bor ),
 		};
+
+	static_assert( impl::is_unique( arithmetic_handler_list ), "Instruction handled more than once." );
+	const handler_list_t arithmetic_handlers = arithmetic_handler_list;
 }
@@ -27,76 +27,79 @@
 //
 #include "../amd64.hpp"
 #include "../flags.hpp"
+#include "../fusion.hpp"
 #include "../../core/processing_flags.hpp"
 
 // Branching instructions.
 // 
 namespace vtil::lifter::amd64
 {
+	// Destinations of the last branch lifted on this thread with an immediate target.
+	//
+	struct direct_branch
+	{
+		const basic_block* block = nullptr;
+		std::vector<uint64_t> targets;
+	};
+	static thread_local direct_branch last_direct_branch = {};
+
+	// Records the destinations of the branch if its target is an immediate, so that the explorer
+	// can follow them without tracing the block.
+	//
+	static void record_targets( basic_block* block, const instruction_info& insn, bool has_fallthrough )
+	{
+		if ( insn.operands.empty() || insn.operands[ 0 ].type != X86_OP_IMM )
+			return;
+
+		last_direct_branch.block = block;
+		last_direct_branch.targets = { ( uint64_t ) insn.operands[ 0 ].imm };
+		if ( has_fallthrough )
+			last_direct_branch.targets.push_back( insn.address + insn.bytes.size() );
+	}
+
+	std::vector<uint64_t> lifter_t::direct_targets( const basic_block* block )
+	{
+		if ( last_direct_branch.block != block )
+			return {};
+		last_direct_branch.block = nullptr;
+		return std::move( last_direct_branch.targets );
+	}
+
+	// Conditional jumps, the condition is fused with a preceding comparison if possible.
+	//
+#define DEFINE_JCC( mnemonic, cc )                                                      \
+        {                                                                               \
+            mnemonic,                                                                   \
+            [ ] ( basic_block* block, const instruction_info& insn )                    \
+            {                                                                           \
+                record_targets( block, insn, true );                                    \
+                block                                                                   \
+                    ->js( flags::evaluate( block, insn, flags::condition_code::cc ),    \
+                          load_operand( block, insn, 0 ),                               \
+                          insn.address + insn.bytes.size() );                           \
+            }                                                                           \
+        }
+
 	// List of handlers.
 	//
-	handler_map_t branch_handlers = {
+	static constexpr handler_entry branch_handler_list[] = {
 		{
 			X86_INS_JMP,
 			[ ] ( basic_block* block, const instruction_info& insn )
 			{
+				record_targets( block, insn, false );
 				block->jmp( load_operand( block, insn, 0 ) );
 			}
 		},
-		{
-			X86_INS_JAE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative cf( flags::CF );
-
-				block
-					->js( ( cf == 0 ), 
-						  load_operand( block, insn, 0 ), 
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JA,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative cf( flags::CF );
-				operative zf( flags::ZF );
-
-				block
-					->js( ( cf == 0 ) & ( zf == 0 ), 
-						  load_operand( block, insn, 0 ), 
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JBE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative cf( flags::CF );
-				operative zf( flags::ZF );
-
-				block
-					->js( ( cf == 1 ) & ( zf == 1 ), 
-						  load_operand( block, insn, 0 ), 
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JB,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative cf( flags::CF );
-
-				block
-					->js( ( cf == 1 ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
+		DEFINE_JCC( X86_INS_JAE, ae ),
+		DEFINE_JCC( X86_INS_JA, a ),
+		DEFINE_JCC( X86_INS_JBE, be ),
+		DEFINE_JCC( X86_INS_JB, b ),
 		{
 			X86_INS_JCXZ,
 			[ ] ( basic_block* block, const instruction_info& insn )
 			{
+				record_targets( block, insn, true );
 				block
 					->js( ( operative( X86_REG_CX ) == 0 ),
 						  load_operand( block, insn, 0 ),
@@ -107,172 +110,36 @@ namespace vtil::lifter::amd64
 			X86_INS_JECXZ,
 			[ ] ( basic_block* block, const instruction_info& insn )
 			{
+				record_targets( block, insn, true );
 				block
 					->js( ( operative( X86_REG_ECX ) == 0 ),
 						  load_operand( block, insn, 0 ),
 						  insn.address + insn.bytes.size() );
 			}
 		},
-		{
-			X86_INS_JE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative zf( flags::ZF );
-
-				block
-					->js( ( zf == 1 ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JGE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative sf( flags::SF );
-				operative of( flags::OF );
-
-				block
-					->js( ( sf == of ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JG,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative sf( flags::SF );
-				operative of( flags::OF );
-				operative zf( flags::ZF );
-
-				block
-					->js( ( zf == 0 ) & ( sf == of ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JLE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative sf( flags::SF );
-				operative of( flags::OF );
-				operative zf( flags::ZF );
-
-				block
-					->js( ( zf == 1 ) & ( sf != of ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JL,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative sf( flags::SF );
-				operative of( flags::OF );
-
-				block
-					->js( ( sf != of ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JNE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative zf( flags::ZF );
-
-				block
-					->js( ( zf == 0 ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JNO,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative of( flags::OF );
-
-				block
-					->js( ( of == 0 ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JNP,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative pf( flags::PF );
-
-				block
-					->js( ( pf == 0 ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JNS,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative sf( flags::SF );
-
-				block
-					->js( ( sf == 0 ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JO,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative of( flags::OF );
-
-				block
-					->js( ( of == 1 ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
-		{
-			X86_INS_JP,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative pf( flags::PF );
-
-				block
-					->js( ( pf == 1 ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
+		DEFINE_JCC( X86_INS_JE, e ),
+		DEFINE_JCC( X86_INS_JGE, ge ),
+		DEFINE_JCC( X86_INS_JG, g ),
+		DEFINE_JCC( X86_INS_JLE, le ),
+		DEFINE_JCC( X86_INS_JL, l ),
+		DEFINE_JCC( X86_INS_JNE, ne ),
+		DEFINE_JCC( X86_INS_JNO, no ),
+		DEFINE_JCC( X86_INS_JNP, np ),
+		DEFINE_JCC( X86_INS_JNS, ns ),
+		DEFINE_JCC( X86_INS_JO, o ),
+		DEFINE_JCC( X86_INS_JP, p ),
 		{
 			X86_INS_JRCXZ,
 			[ ] ( basic_block* block, const instruction_info& insn )
 			{
+				record_targets( block, insn, true );
 				block
 					->js( ( operative( X86_REG_RCX ) == 0 ),
 						  load_operand( block, insn, 0 ),
 						  insn.address + insn.bytes.size() );
 			}
 		},
-		{
-			X86_INS_JS,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				operative sf( flags::SF );
-
-				block
-					->js( ( sf == 1 ),
-						  load_operand( block, insn, 0 ),
-						  insn.address + insn.bytes.size() );
-			}
-		},
+		DEFINE_JCC( X86_INS_JS, s ),
 		{
 			X86_INS_CALL,
 			[ ] ( basic_block* block, const instruction_info& insn )
@@ -282,6 +149,7 @@ namespace vtil::lifter::amd64
 					auto vip_after_insn = insn.address + insn.bytes.size();
 					block->sub( X86_REG_RSP, 8 );
 					block->str( X86_REG_RSP, 0, vip_after_insn );
+					record_targets( block, insn, false );
 					block->jmp( load_operand( block, insn, 0 ) );
 				}
 				else
@@ -305,6 +173,7 @@ namespace vtil::lifter::amd64
 			X86_INS_LOOP,
 			[ ] ( basic_block* block, const instruction_info& insn )
 			{
+				record_targets( block, insn, true );
 				block
 					->sub( X86_REG_RCX, 1 )
 					->js( ( operative( X86_REG_RCX ) != 0 ),
@@ -316,6 +185,7 @@ namespace vtil::lifter::amd64
 			X86_INS_LOOPE,
 			[ ] ( basic_block* block, const instruction_info& insn )
 			{
+				record_targets( block, insn, true );
 				operative zf( flags::ZF );
 				block
 					->sub( X86_REG_RCX, 1 )
@@ -328,6 +198,7 @@ namespace vtil::lifter::amd64
 			X86_INS_LOOPNE,
 			[ ] ( basic_block* block, const instruction_info& insn )
 			{
+				record_targets( block, insn, true );
 				operative zf( flags::ZF );
 				block
 					->sub( X86_REG_RCX, 1 )
@@ -337,4 +208,7 @@ namespace vtil::lifter::amd64
 			}
 		}
 	};
+
+	static_assert( impl::is_unique( branch_handler_list ), "Instruction handled more than once." );
+	const handler_list_t branch_handlers = branch_handler_list;
 }
\ No newline at end of file
@@ -27,50 +27,84 @@
 //
 #include "../amd64.hpp"
 #include "../flags.hpp"
+#include "../lazy_flags.hpp"
+#include "../flag_update.hpp"
+#include "../fusion.hpp"
 
 // Various x86 comparison instructions.
 // 
 namespace vtil::lifter::amd64
 {
+	// Conditional moves, the condition is fused with a preceding comparison if possible.
+	//
+#define DEFINE_CMOV( mnemonic, cc )                                                         \
+        {                                                                                   \
+            mnemonic,                                                                       \
+            [ ] ( basic_block* block, const instruction_info& insn )                        \
+            {                                                                               \
+                auto result = flags::evaluate( block, insn, flags::condition_code::cc );    \
+                auto lhs = operative( load_operand( block, insn, 0 ) );                     \
+                auto rhs = operative( load_operand( block, insn, 1 ) );                     \
+                store_operand( block, insn, 0, operative::select( result, rhs, lhs ) );     \
+            }                                                                               \
+        }
+
 	// List of handlers.
 	//
-	handler_map_t comparison_handlers = {
+	static constexpr handler_entry comparison_handler_list[] = {
 		{
 			X86_INS_CMP,
-			[ ] ( basic_block* block, const instruction_info& insn )
+			shape_dispatch<[ ] ( auto shape, basic_block* block, const instruction_info& insn )
 			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( block->tmp( lhs.op.bit_count() ) );
+				using shape_t = decltype( shape );
+				auto lhs = operative( load_operand<shape_t::destination>( block, insn.operands[ 0 ] ) );
 
-				block->movsx( rhs, load_operand( block, insn, 1 ) );
+				// Immediates are already sign-extended by the decoder, so they only need resizing.
+				//
+				auto rhs = operative( shape_t::source == X86_OP_IMM
+					? operand( insn.operands[ 1 ].imm, lhs.op.bit_count() )
+					: load_operand<shape_t::source>( block, insn.operands[ 1 ] ) );
 
 				auto result = lhs - rhs;
+				flags::record_comparison( block, insn, flags::sub, lhs.op, rhs.op );
 
-				block
-					->mov( flags::CF, flags::carry<flags::sub>::flag( lhs, rhs, result ) )
-					->mov( flags::OF, flags::overflow<flags::sub>::flag( lhs, rhs, result ) )
-					->mov( flags::SF, flags::sign( result ) )
-					->mov( flags::ZF, flags::zero( result ) )
-					->mov( flags::AF, flags::aux_carry( lhs, rhs, result ) )
-					->mov( flags::PF, flags::parity( result ) );
-			}
+				if ( flags::is_lazy( block ) )
+					return flags::defer( block, flags::sub, lhs.op, rhs.op, result.op );
+
+				flags::flag_update( block )
+					.set( flags::CF, flags::carry<flags::sub>::flag( lhs, rhs, result ) )
+					.set( flags::OF, flags::overflow<flags::sub>::flag( lhs, rhs, result ) )
+					.set( flags::SF, flags::sign( result ) )
+					.set( flags::ZF, flags::zero( result ) )
+					.set( flags::AF, flags::aux_carry( lhs, rhs, result ) )
+					.set( flags::PF, flags::parity( result ) )
+					.emit();
+			}>
 		},
 		{
 			X86_INS_TEST,
-			[ ] ( basic_block* block, const instruction_info& insn )
+			shape_dispatch<[ ] ( auto shape, basic_block* block, const instruction_info& insn )
 			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
+				using shape_t = decltype( shape );
+				auto lhs = operative( load_operand<shape_t::destination>( block, insn.operands[ 0 ] ) );
+				auto rhs = operative( load_operand<shape_t::source>( block, insn.operands[ 1 ] ) );
 
 				auto result = lhs & rhs;
+				flags::record_comparison( block, insn, flags::band, lhs.op, rhs.op );
 
-				block
-					->mov( flags::CF, 0 )
-					->mov( flags::OF, 0 )
-					->mov( flags::SF, flags::sign( result ) )
-					->mov( flags::ZF, flags::zero( result ) )
-					->mov( flags::PF, flags::parity( result ) );
-			}
+				// AF is left undefined.
+				//
+				if ( flags::is_lazy( block ) )
+					return flags::defer( block, flags::band, lhs.op, rhs.op, result.op, flags::all_mask & ~flags::af_mask );
+
+				flags::flag_update( block )
+					.set( flags::CF, 0 )
+					.set( flags::OF, 0 )
+					.set( flags::SF, flags::sign( result ) )
+					.set( flags::ZF, flags::zero( result ) )
+					.set( flags::PF, flags::parity( result ) )
+					.emit();
+			}>
 		},
 		{
 			X86_INS_CMPXCHG,
@@ -81,275 +115,33 @@ namespace vtil::lifter::amd64
 				auto rhs = operative( load_operand( block, insn, 1 ) );
 				auto temp = lhs;
 
-				block
-					->mov( flags::ZF, 
-						   __if( accumulator == temp, 1 ) )
-					->mov( X86_REG_RAX, 
-						   __if( accumulator == temp, lhs ) | 
-						   __if( ~( accumulator == temp ), temp ) );
-
-				store_operand( block, insn, 0, 
-							   __if( accumulator == temp, rhs ) | 
-							   __if( ~(accumulator == temp), temp ) );
-			}
-		},
-		{
-			X86_INS_CMOVA,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative cf( flags::CF );
-				operative zf( flags::ZF );
-
-				auto result = ( zf == 0 ) & ( cf == 0 );
-				
-				store_operand( block, insn, 0, 
-							   __if( result, rhs ) | 
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVAE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative cf( flags::CF );
-
-				store_operand( block, insn, 0,
-							   __if( ( cf == 0 ), rhs ) |
-							   __if( ( cf == 1 ), lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVB,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative cf( flags::CF );
-
-				store_operand( block, insn, 0,
-							   __if( ( cf == 1 ), rhs ) |
-							   __if( ( cf == 0 ), lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVBE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative cf( flags::CF );
-				operative zf( flags::ZF );
-
-				auto result = ( ( zf == 1 ) | ( cf == 1 ) );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative zf( flags::ZF );
-
-				store_operand( block, insn, 0,
-							   __if( ( zf == 1 ), rhs ) |
-							   __if( ( zf == 0 ), lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVG,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative sf( flags::SF );
-				operative zf( flags::ZF );
-				operative of( flags::OF );
-
-				auto result = ( ( zf == 0 ) & ( sf == of ) );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVGE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative sf( flags::SF );
-				operative of( flags::OF );
-
-				auto result = ( sf == of );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVL,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative sf( flags::SF );
-				operative of( flags::OF );
-
-				auto result = ( sf != of );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVLE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative sf( flags::SF );
-				operative zf( flags::ZF );
-				operative of( flags::OF );
-
-				auto result = ( ( zf == 1 ) | ( sf != of ) );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVNE,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative zf( flags::ZF );
+				auto equal = accumulator == temp;
 
-				auto result = ( zf == 0 );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVNO,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative of( flags::OF );
-
-				auto result = ( of == 0 );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVNP,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative pf( flags::PF );
-
-				auto result = ( pf == 0 );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVNS,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative sf( flags::SF );
-
-				auto result = ( sf == 0 );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVO,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative of( flags::OF );
-
-				auto result = ( of == 1 );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVP,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative pf( flags::PF );
-
-				auto result = ( pf == 1 );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
-		{
-			X86_INS_CMOVS,
-			[ ] ( basic_block* block, const instruction_info& insn )
-			{
-				auto lhs = operative( load_operand( block, insn, 0 ) );
-				auto rhs = operative( load_operand( block, insn, 1 ) );
-
-				operative sf( flags::SF );
-
-				auto result = ( sf == 1 );
-
-				store_operand( block, insn, 0,
-							   __if( result, rhs ) |
-							   __if( ~result, lhs ) );
-			}
-		},
+				block
+					->mov( flags::ZF, equal )
+					->mov( X86_REG_RAX, operative::select( equal, lhs, temp ) );
+
+				store_operand( block, insn, 0, operative::select( equal, rhs, temp ) );
+			}
+		},
+		DEFINE_CMOV( X86_INS_CMOVA, a ),
+		DEFINE_CMOV( X86_INS_CMOVAE, ae ),
+		DEFINE_CMOV( X86_INS_CMOVB, b ),
+		DEFINE_CMOV( X86_INS_CMOVBE, be ),
+		DEFINE_CMOV( X86_INS_CMOVE, e ),
+		DEFINE_CMOV( X86_INS_CMOVG, g ),
+		DEFINE_CMOV( X86_INS_CMOVGE, ge ),
+		DEFINE_CMOV( X86_INS_CMOVL, l ),
+		DEFINE_CMOV( X86_INS_CMOVLE, le ),
+		DEFINE_CMOV( X86_INS_CMOVNE, ne ),
+		DEFINE_CMOV( X86_INS_CMOVNO, no ),
+		DEFINE_CMOV( X86_INS_CMOVNP, np ),
+		DEFINE_CMOV( X86_INS_CMOVNS, ns ),
+		DEFINE_CMOV( X86_INS_CMOVO, o ),
+		DEFINE_CMOV( X86_INS_CMOVP, p ),
+		DEFINE_CMOV( X86_INS_CMOVS, s ),
 	};
+
+	static_assert( impl::is_unique( comparison_handler_list ), "Instruction handled more than once." );
+	const handler_list_t comparison_handlers = comparison_handler_list;
 }
\ No newline at end of file
@@ -27,6 +27,7 @@
 //
 #include "../amd64.hpp"
 #include "../flags.hpp"
+#include "../fusion.hpp"
 
 // Flag manipulation instructions.
 //
@@ -46,102 +47,14 @@ namespace vtil::lifter::amd64
 
 	void process_cmc( basic_block* block, const instruction_info& insn ) { block->bnot( flags::CF ); }
 
-	void process_seta( basic_block* block, const instruction_info& insn )
+	// Stores the condition, fused with a preceding comparison if possible.
+	//
+	template<flags::condition_code cc>
+	void process_setcc( basic_block* block, const instruction_info& insn )
 	{
-		operative cf( flags::CF );
-		operative zf( flags::ZF );
-
-		store_operand( block, insn, 0, ( cf == 0 ) & ( zf == 0 ) );
-	}
-
-	void process_setae( basic_block* block, const instruction_info& insn )
-	{
-		operative cf( flags::CF );
-
-		store_operand( block, insn, 0, ( cf == 0 ) );
-	}
-
-	void process_setb( basic_block* block, const instruction_info& insn ) { store_operand( block, insn, 0, { flags::CF } ); }
-
-	void process_setbe( basic_block* block, const instruction_info& insn )
-	{
-		operative cf( flags::CF );
-		operative zf( flags::ZF );
-
-		store_operand( block, insn, 0, ( cf | zf ) );
-	}
-
-	void process_sete( basic_block* block, const instruction_info& insn ) { store_operand( block, insn, 0, { flags::ZF } ); }
-
-	void process_setge( basic_block* block, const instruction_info& insn )
-	{
-		operative sf( flags::SF );
-		operative of( flags::OF );
-
-		store_operand( block, insn, 0, ( sf & of ) );
-	}
-
-	void process_setg( basic_block* block, const instruction_info& insn )
-	{
-		operative sf( flags::SF );
-		operative of( flags::OF );
-		operative zf( flags::ZF );
-
-		store_operand( block, insn, 0, ( ( zf == 0 ) & ( sf == of ) ) );
-	}
-
-	void process_setle( basic_block* block, const instruction_info& insn )
-	{
-		operative sf( flags::SF );
-		operative of( flags::OF );
-		operative zf( flags::ZF );
-
-		store_operand( block, insn, 0, ( zf & ( sf != of ) ) );
+		store_operand( block, insn, 0, flags::evaluate( block, insn, cc ) );
 	}
 
-	void process_setl( basic_block* block, const instruction_info& insn )
-	{
-		operative sf( flags::SF );
-		operative of( flags::OF );
-		operative zf( flags::ZF );
-
-		store_operand( block, insn, 0, ( sf != of ) );
-	}
-
-	void process_setne( basic_block* block, const instruction_info& insn )
-	{
-		operative zf( flags::ZF );
-
-		store_operand( block, insn, 0, ( zf == 0 ) );
-	}
-
-	void process_setno( basic_block* block, const instruction_info& insn )
-	{
-		operative of( flags::OF );
-
-		store_operand( block, insn, 0, ( of == 0 ) );
-	}
-
-	void process_setnp( basic_block* block, const instruction_info& insn )
-	{
-		operative pf( flags::PF );
-
-		store_operand( block, insn, 0, ( pf == 0 ) );
-	}
-
-	void process_setns( basic_block* block, const instruction_info& insn )
-	{
-		operative sf( flags::SF );
-
-		store_operand( block, insn, 0, ( sf == 0 ) );
-	}
-
-	void process_seto( basic_block* block, const instruction_info& insn ) { store_operand( block, insn, 0, { flags::OF } ); }
-
-	void process_setp( basic_block* block, const instruction_info& insn ) { store_operand( block, insn, 0, { flags::PF } ); }
-
-	void process_sets( basic_block* block, const instruction_info& insn ) { store_operand( block, insn, 0, { flags::SF } ); }
-
 	operative simple_bt( basic_block* block, const operative& lhs, const operative& rhs )
 	{
 		uint64_t mask;
@@ -219,7 +132,7 @@ namespace vtil::lifter::amd64
 			->mov( REG_FLAGS, X86_REG_AH );
 	}
 
-	handler_map_t flags_handlers = { 
+	static constexpr handler_entry flags_handler_list[] = { 
 		  { X86_INS_CLC, process_clc },
 		  { X86_INS_CLD, process_cld },
 		  { X86_INS_CLI, process_cli },	  
@@ -227,22 +140,22 @@ namespace vtil::lifter::amd64
 		  { X86_INS_STD, process_std },
 		  { X86_INS_STI, process_sti },
 		  { X86_INS_CMC, process_cmc },
-		  { X86_INS_SETA, process_seta },	  
-		  { X86_INS_SETAE, process_setae }, 
-		  { X86_INS_SETB, process_setb },	  
-		  { X86_INS_SETBE, process_setbe },
-		  { X86_INS_SETE, process_sete },
-		  { X86_INS_SETGE, process_setge }, 
-		  { X86_INS_SETG, process_setg },	
-		  { X86_INS_SETLE, process_setle }, 
-		  { X86_INS_SETL, process_setl },
-		  { X86_INS_SETNE, process_setne },
-		  { X86_INS_SETNO, process_setno }, 
-		  { X86_INS_SETNP, process_setnp }, 
-		  { X86_INS_SETNS, process_setns }, 
-		  { X86_INS_SETO, process_seto },
-		  { X86_INS_SETP, process_setp },
-		  { X86_INS_SETS, process_sets },	  
+		  { X86_INS_SETA, process_setcc<flags::condition_code::a> },	  
+		  { X86_INS_SETAE, process_setcc<flags::condition_code::ae> }, 
+		  { X86_INS_SETB, process_setcc<flags::condition_code::b> },	  
+		  { X86_INS_SETBE, process_setcc<flags::condition_code::be> },
+		  { X86_INS_SETE, process_setcc<flags::condition_code::e> },
+		  { X86_INS_SETGE, process_setcc<flags::condition_code::ge> }, 
+		  { X86_INS_SETG, process_setcc<flags::condition_code::g> },	
+		  { X86_INS_SETLE, process_setcc<flags::condition_code::le> }, 
+		  { X86_INS_SETL, process_setcc<flags::condition_code::l> },
+		  { X86_INS_SETNE, process_setcc<flags::condition_code::ne> },
+		  { X86_INS_SETNO, process_setcc<flags::condition_code::no> }, 
+		  { X86_INS_SETNP, process_setcc<flags::condition_code::np> }, 
+		  { X86_INS_SETNS, process_setcc<flags::condition_code::ns> }, 
+		  { X86_INS_SETO, process_setcc<flags::condition_code::o> },
+		  { X86_INS_SETP, process_setcc<flags::condition_code::p> },
+		  { X86_INS_SETS, process_setcc<flags::condition_code::s> },	  
 		  { X86_INS_BT, process_bt },		
 		  { X86_INS_BTC, process_btc },	  
 		  { X86_INS_BTR, process_btr },
@@ -250,4 +163,7 @@ namespace vtil::lifter::amd64
 		  { X86_INS_LAHF, process_lahf }, 
 		  { X86_INS_SAHF, process_sahf } 
 	};
+
+	static_assert( impl::is_unique( flags_handler_list ), "Instruction handled more than once." );
+	const handler_list_t flags_handlers = flags_handler_list;
 }
\ No newline at end of file
@@ -32,7 +32,7 @@ namespace vtil::lifter::amd64
 {
 	// List of handlers.
 	//
-	handler_map_t misc_handlers = {
+	static constexpr handler_entry misc_handler_list[] = {
 		{
 			X86_INS_INVALID,
 			[ ] ( basic_block* block, const instruction_info& insn )
@@ -136,23 +136,31 @@ namespace vtil::lifter::amd64
 		},
 		{
 			X86_INS_MOV,
-			[ ] ( basic_block* block, const instruction_info& insn )
+			shape_dispatch<[ ] ( auto shape, basic_block* block, const instruction_info& insn )
 			{
-				store_operand( block, insn, 0, load_operand( block, insn, 1 ) );
-			}
+				using shape_t = decltype( shape );
+				store_operand<shape_t::destination>( block, insn.operands[ 0 ], load_operand<shape_t::source>( block, insn.operands[ 1 ] ) );
+			}>
 		},
 		{
 			X86_INS_MOVABS,
-			[ ] ( basic_block* block, const instruction_info& insn )
+			shape_dispatch<[ ] ( auto shape, basic_block* block, const instruction_info& insn )
 			{
-				store_operand( block, insn, 0, load_operand( block, insn, 1 ) );
-			}
+				using shape_t = decltype( shape );
+				store_operand<shape_t::destination>( block, insn.operands[ 0 ], load_operand<shape_t::source>( block, insn.operands[ 1 ] ) );
+			}>
 		},
 		{
 			X86_INS_MOVZX,
 			[ ] ( basic_block* block, const instruction_info& insn )
 			{
-				store_operand( block, insn, 0, load_operand( block, insn, 1 ) );
+				// The source is only read by the store, so a register is used in place and the
+				// zero-extending store leaves a single write.
+				//
+				auto& source = insn.operands[ 1 ];
+				store_operand( block, insn, 0, source.type == X86_OP_REG
+					? load_operand<X86_OP_REG>( block, source )
+					: load_operand<X86_OP_MEM>( block, source ) );
 			}
 		},
 		{
@@ -302,4 +310,7 @@ namespace vtil::lifter::amd64
 			}
 		},
 	};
+
+	static_assert( impl::is_unique( misc_handler_list ), "Instruction handled more than once." );
+	const handler_list_t misc_handlers = misc_handler_list;
 }
@@ -0,0 +1,212 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include "recursive_descent.hpp"
+
+namespace vtil::lifter
+{
+	// Counters describing how much lifting the shared block store saved.
+	//
+	struct batch_statistics
+	{
+		// Entry points that were already a block of the store when their turn came, or that
+		// were reached in the middle of one and split it.
+		//
+		size_t shared_entries = 0;
+
+		// Entry points whose exploration ran out of budget, the budgets apply to each separately.
+		//
+		size_t truncated_entries = 0;
+
+		// Blocks and instructions actually lifted into the store.
+		//
+		size_t lifted_blocks = 0;
+		size_t lifted_instructions = 0;
+
+		// Blocks and instructions reachable from each entry point summed over all of them,
+		// which is what lifting every function on its own would have produced.
+		//
+		size_t referenced_blocks = 0;
+		size_t referenced_instructions = 0;
+
+		size_t saved_blocks() const { return referenced_blocks - lifted_blocks; }
+		size_t saved_instructions() const { return referenced_instructions - lifted_instructions; }
+	};
+
+	// Lifts many entry points over a single input into one routine used as a store of lifted
+	// blocks, so that the code shared between functions such as tails, thunks and error paths
+	// is only lifted once. Routines for the individual functions are assembled from the store.
+	//
+	template<typename input_type, typename arch>
+	struct batch_descent
+	{
+		// Explorer lifting into the store, its routine holds every block lifted.
+		//
+		recursive_descent<input_type, arch> store;
+
+		// Entry points of the functions.
+		//
+		std::vector<vip_t> entry_points;
+
+		// Deduplication counters, valid after explore.
+		//
+		batch_statistics stats;
+
+		// Constructor.
+		//
+		batch_descent( const input_type* input, std::vector<vip_t> entry_points, processing_flags flags = {} )
+			: store( input, entry_points.at( 0 ), flags ), entry_points( std::move( entry_points ) ) {}
+
+		// Returns the blocks reachable from the given block.
+		//
+		static std::vector<basic_block*> collect_reachable( basic_block* entry_blk )
+		{
+			std::unordered_set<basic_block*> visited = { entry_blk };
+			std::vector<basic_block*> blocks = { entry_blk };
+			for ( size_t n = 0; n != blocks.size(); n++ )
+			{
+				for ( auto next : blocks[ n ]->next )
+					if ( visited.insert( next ).second )
+						blocks.push_back( next );
+			}
+			return blocks;
+		}
+
+		// Lifts every entry point into the store.
+		//
+		void explore()
+		{
+			routine* rtn = store.owner_rtn.get();
+
+			if ( rtn->context.get<processing_flags>().predecode_leaders )
+				store.discover_leaders( entry_points );
+
+			for ( vip_t vip : entry_points )
+			{
+				if ( !store.input->is_valid( vip ) )
+					continue;
+
+				if ( vip == store.entry->entry_vip )
+				{
+					if ( store.entry->empty() )
+						stats.truncated_entries += store.populate( store.entry ) != exploration_status::complete;
+					else
+						stats.shared_entries++;
+					continue;
+				}
+
+				// Entry points inside of a lifted block split it rather than lifting the code again.
+				//
+				if ( store.split_at( vip ) )
+					stats.shared_entries++;
+				else if ( auto [blk, inserted] = rtn->create_block( vip ); inserted )
+					stats.truncated_entries += store.populate( blk ) != exploration_status::complete;
+				else
+					stats.shared_entries++;
+			}
+
+			// Compare the work done to what lifting each entry point on its own would have taken.
+			//
+			rtn->for_each( [ & ] ( basic_block* blk )
+			{
+				stats.lifted_blocks++;
+				stats.lifted_instructions += blk->size();
+			} );
+			for ( vip_t vip : entry_points )
+			{
+				if ( auto entry_blk = rtn->find_block( vip ) )
+				{
+					for ( auto blk : collect_reachable( entry_blk ) )
+					{
+						stats.referenced_blocks++;
+						stats.referenced_instructions += blk->size();
+					}
+				}
+			}
+		}
+
+		// Assembles the routine of the function at the given entry point out of the blocks in the
+		// store reachable from it, returns null if the entry point was not lifted. Only the reachable
+		// blocks are copied, links from blocks of other functions are left out.
+		//
+		std::unique_ptr<routine> assemble( vip_t entry_point ) const
+		{
+			routine* src = store.owner_rtn.get();
+			basic_block* src_entry = src->find_block( entry_point );
+			if ( !src_entry )
+				return nullptr;
+
+			std::unique_ptr<routine> rtn{ new routine{ src->arch_id } };
+			rtn->routine_convention = src->routine_convention;
+			rtn->subroutine_convention = src->subroutine_convention;
+			rtn->spec_subroutine_conventions = src->spec_subroutine_conventions;
+			rtn->context = src->context;
+			rtn->last_internal_id = src->last_internal_id.load();
+
+			// Copy the instructions along with their stack pointer state.
+			//
+			auto reachable = collect_reachable( src_entry );
+			std::unordered_map<const basic_block*, basic_block*> copies;
+			for ( auto blk : reachable )
+			{
+				basic_block* copy = rtn->create_block( blk->entry_vip ).first;
+				for ( auto& ins : *blk )
+				{
+					copy->push_back( ins );
+					copy->wback().sp_offset = ins.sp_offset;
+					copy->wback().sp_index = ins.sp_index;
+				}
+				copy->sp_offset = blk->sp_offset;
+				copy->sp_index = blk->sp_index;
+				copy->last_temporary_index = blk->last_temporary_index;
+				copies.emplace( blk, copy );
+			}
+
+			// Every successor is reachable, predecessors outside of the function are dropped.
+			//
+			for ( auto blk : reachable )
+			{
+				basic_block* copy = copies.at( blk );
+				for ( auto next : blk->next )
+					copy->next.push_back( copies.at( next ) );
+				for ( auto prev : blk->prev )
+				{
+					if ( auto it = copies.find( prev ); it != copies.end() )
+						copy->prev.push_back( it->second );
+				}
+			}
+
+			rtn->entry_point = copies.at( src_entry );
+			return rtn;
+		}
+	};
+};
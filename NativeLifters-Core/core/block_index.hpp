@@ -0,0 +1,199 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+namespace vtil::lifter
+{
+	// Checks if any temporary written before the given instruction is read at or after it. Uses
+	// the same backwards liveness scan as the dead flag elimination.
+	//
+	inline bool has_live_temporaries( const basic_block* block, basic_block::const_iterator split )
+	{
+		std::unordered_map<uint64_t, uint64_t> live_temporaries;
+		for ( auto it = block->end(); it != split; )
+		{
+			--it;
+			const instruction& ins = *it;
+
+			if ( !ins.operands.empty() && ins.base->operand_types[ 0 ] == operand_type::write &&
+				 ins.operands[ 0 ].is_register() && ins.operands[ 0 ].reg().is_local() )
+				live_temporaries[ ins.operands[ 0 ].reg().local_id ] &= ~ins.operands[ 0 ].reg().get_mask();
+
+			for ( size_t i = 0; i != ins.operands.size(); i++ )
+			{
+				if ( ins.operands[ i ].is_register() && ins.operands[ i ].reg().is_local() && ins.base->operand_types[ i ] != operand_type::write )
+					live_temporaries[ ins.operands[ i ].reg().local_id ] |= ins.operands[ i ].reg().get_mask();
+			}
+		}
+		return std::any_of( live_temporaries.begin(), live_temporaries.end(), [ ] ( auto& pair ) { return pair.second != 0; } );
+	}
+
+	// Splits the block right before the first instruction lifted from the given address, moving
+	// the instructions from there on to a new block entered with a jump. The stack pointer state
+	// of the moved instructions is rebased on the split point. Returns the new block, or null if
+	// no instruction starts at the address or a temporary is live across it.
+	//
+	inline basic_block* split_block( basic_block* block, vip_t vip )
+	{
+		auto split = std::find_if( block->begin(), block->end(), [ & ] ( const instruction& ins ) { return ins.vip == vip; } );
+		if ( split == block->begin() || split == block->end() || has_live_temporaries( block, split ) )
+			return nullptr;
+
+		auto [next_blk, inserted] = block->owner->create_block( vip );
+		if ( !inserted )
+			return nullptr;
+
+		// Move the tail over, relative to the stack state at the split point.
+		//
+		const int64_t sp_offset = split->sp_offset;
+		const uint32_t sp_index = split->sp_index;
+
+		next_blk->last_temporary_index = block->last_temporary_index;
+		for ( auto it = split; it != block->end(); ++it )
+		{
+			next_blk->push_back( *it );
+			next_blk->wback().sp_offset = it->sp_offset - sp_offset;
+			next_blk->wback().sp_index = it->sp_index - sp_index;
+		}
+		next_blk->sp_offset = block->sp_offset - sp_offset;
+		next_blk->sp_index = block->sp_index - sp_index;
+
+		while ( split != block->end() )
+			split = block->erase( split );
+		block->sp_offset = sp_offset;
+		block->sp_index = sp_index;
+		block->jmp( vip );
+
+		// The new block takes over the successors.
+		//
+		next_blk->next = std::move( block->next );
+		for ( auto successor : next_blk->next )
+			std::replace( successor->prev.begin(), successor->prev.end(), block, next_blk );
+		block->next = { next_blk };
+		next_blk->prev = { block };
+		return next_blk;
+	}
+
+	// Index of the address ranges lifted into each block, along with the addresses at which the
+	// blocks may be split, used to find the block a branch lands in the middle of.
+	//
+	struct block_index
+	{
+		struct entry
+		{
+			vip_t end;
+			basic_block* block;
+
+			// Instruction addresses past the start of the block that can be split at, ascending.
+			//
+			std::vector<vip_t> boundaries;
+		};
+
+		// Ranges keyed by their start.
+		//
+		std::map<vip_t, entry> ranges;
+
+		// Length of the longest range recorded, ranges may nest so this bounds how far before
+		// an address the ranges covering it can start.
+		//
+		vip_t longest = 0;
+
+		// Records the range [begin, end) lifted into the block.
+		//
+		void insert( basic_block* block, vip_t begin, vip_t end, std::vector<vip_t> boundaries )
+		{
+			longest = std::max( longest, end - begin );
+			ranges.insert_or_assign( begin, entry{ end, block, std::move( boundaries ) } );
+		}
+
+		// Forgets the range of the block.
+		//
+		void erase( const basic_block* block )
+		{
+			if ( auto it = ranges.find( block->entry_vip ); it != ranges.end() && it->second.block == block )
+				ranges.erase( it );
+		}
+
+		// Returns the blocks whose range intersects [begin, end).
+		//
+		std::vector<basic_block*> overlapping( vip_t begin, vip_t end ) const
+		{
+			std::vector<basic_block*> blocks;
+			auto it = ranges.lower_bound( begin > longest ? begin - longest : 0 );
+			for ( ; it != ranges.end() && it->first < end; ++it )
+			{
+				if ( it->second.end > begin )
+					blocks.push_back( it->second.block );
+			}
+			return blocks;
+		}
+
+		// Finds the range the address lands strictly inside of.
+		//
+		entry* find_inside( vip_t vip )
+		{
+			auto it = ranges.upper_bound( vip );
+			if ( it == ranges.begin() )
+				return nullptr;
+			--it;
+			if ( it->first == vip || vip >= it->second.end )
+				return nullptr;
+			return &it->second;
+		}
+
+		// Splits the block lifted over the address if it lands inside of one at a boundary,
+		// returns the new block on success.
+		//
+		basic_block* split_at( vip_t vip )
+		{
+			auto* range = find_inside( vip );
+			if ( !range || !std::binary_search( range->boundaries.begin(), range->boundaries.end(), vip ) )
+				return nullptr;
+
+			auto next_blk = split_block( range->block, vip );
+			if ( !next_blk )
+				return nullptr;
+
+			// Divide the range and its boundaries between the two blocks.
+			//
+			auto pivot = std::upper_bound( range->boundaries.begin(), range->boundaries.end(), vip );
+			std::vector<vip_t> tail_boundaries = { pivot, range->boundaries.end() };
+			range->boundaries.erase( std::prev( pivot ), range->boundaries.end() );
+
+			vip_t end = range->end;
+			range->end = vip;
+			insert( next_blk, vip, end, std::move( tail_boundaries ) );
+			return next_blk;
+		}
+	};
+};
@@ -0,0 +1,218 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <vtil/compiler>
+#include <optional>
+#include <unordered_map>
+#include <initializer_list>
+
+namespace vtil::lifter
+{
+	// Translator kept for the lifetime of a basic block rather than a single instruction, so that
+	// expressions repeated across instructions such as flag computations or addresses are only
+	// emitted once. Every cached result remembers the registers it was computed from and is
+	// dropped once any of them, or the register holding the result, is written by the block.
+	// Results held in temporaries are also dropped where the block may be split later on.
+	//
+	struct block_translator
+	{
+		// Hash-consing of the expressions by value rather than by reference.
+		//
+		struct expression_hasher
+		{
+			size_t operator()( const symbolic::expression::reference& exp ) const noexcept
+			{
+				return exp->hash().as64();
+			}
+		};
+		struct expression_equal
+		{
+			bool operator()( const symbolic::expression::reference& a, const symbolic::expression::reference& b ) const
+			{
+				return a->is_identical( *b );
+			}
+		};
+
+		struct entry
+		{
+			operand result;
+			std::vector<register_desc> sources;
+		};
+
+		basic_block* block = nullptr;
+		vip_t entry_vip = invalid_vip;
+
+		// Translator of the current instruction, resolves the subexpressions within it.
+		//
+		std::optional<batch_translator> batch;
+
+		// Results of the expressions translated so far within the block.
+		//
+		std::unordered_map<symbolic::expression::reference, entry, expression_hasher, expression_equal> cache;
+
+		// Last instruction checked for register writes and the number of instructions checked.
+		//
+		std::optional<basic_block::iterator> scanned;
+		size_t scanned_count = 0;
+
+		// Starts translating the next instruction of the given block, discarding the cache if
+		// the block changed or lost instructions since the last call.
+		//
+		void begin( basic_block* new_block )
+		{
+			if ( block != new_block || entry_vip != new_block->entry_vip || new_block->size() < scanned_count )
+			{
+				cache.clear();
+				scanned.reset();
+				scanned_count = 0;
+				block = new_block;
+				entry_vip = new_block->entry_vip;
+			}
+			batch.emplace( block );
+		}
+
+		// Forgets the block, called once it is complete.
+		//
+		void reset()
+		{
+			cache.clear();
+			batch.reset();
+			scanned.reset();
+			scanned_count = 0;
+			block = nullptr;
+			entry_vip = invalid_vip;
+		}
+
+		// Drops the cached results held in temporaries, so that none of the temporaries written
+		// so far is read by the instructions appended from here on.
+		//
+		void drop_temporaries()
+		{
+			std::erase_if( cache, [ ] ( const auto& pair )
+			{
+				auto& result = pair.second.result;
+				return result.is_register() && result.reg().is_local();
+			} );
+		}
+
+		// Drops the cached results invalidated by the instructions appended since the last check.
+		//
+		void observe_writes()
+		{
+			auto it = next_unscanned();
+			for ( ; it != block->end(); ++it )
+			{
+				scanned = it;
+				scanned_count++;
+
+				if ( cache.empty() )
+					continue;
+				if ( it->is_volatile() )
+				{
+					cache.clear();
+					continue;
+				}
+
+				for ( size_t n = 0; n != it->operands.size(); n++ )
+				{
+					if ( !it->operands[ n ].is_register() )
+						continue;
+					if ( it->base->operand_types[ n ] < operand_type::write && it->base != &ins::vpinw )
+						continue;
+
+					auto& written = it->operands[ n ].reg();
+					std::erase_if( cache, [ & ] ( const auto& pair )
+					{
+						auto& [ exp, result ] = pair;
+						if ( result.result.is_register() && result.result.reg().overlaps( written ) )
+							return true;
+						for ( auto& source : result.sources )
+							if ( source.overlaps( written ) )
+								return true;
+						return false;
+					} );
+				}
+			}
+		}
+
+		// Translates the expression built from the given operands, reusing the earlier result
+		// if the same expression was already emitted and none of its sources changed since.
+		//
+		operand translate( const symbolic::expression::reference& exp, std::initializer_list<const operand*> operands )
+		{
+			observe_writes();
+			if ( auto it = cache.find( exp ); it != cache.end() )
+				return it->second.result;
+
+			operand result = *batch << exp;
+
+			// Instructions emitted by the translation only write its own temporaries.
+			//
+			observe_writes_silently();
+
+			// Stack pointer is relative to the offset at the point of use, so results
+			// depending on it cannot be carried over.
+			//
+			entry e = { result };
+			for ( const operand* op : operands )
+			{
+				if ( !op->is_register() )
+					continue;
+				if ( op->reg().is_stack_pointer() )
+					return result;
+				e.sources.push_back( op->reg() );
+			}
+			cache.emplace( exp, std::move( e ) );
+			return result;
+		}
+
+	private:
+		// First instruction not yet checked for register writes.
+		//
+		basic_block::iterator next_unscanned() const
+		{
+			if ( !scanned )
+				return block->begin();
+			auto it = *scanned;
+			return ++it;
+		}
+
+		// Marks the instructions appended so far as checked without invalidating anything.
+		//
+		void observe_writes_silently()
+		{
+			auto it = next_unscanned();
+			for ( ; it != block->end(); ++it )
+			{
+				scanned = it;
+				scanned_count++;
+			}
+		}
+	};
+};
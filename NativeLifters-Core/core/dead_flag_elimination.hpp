@@ -0,0 +1,120 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <unordered_map>
+
+namespace vtil::lifter
+{
+	// Counters describing the work done by eliminate_dead_flags.
+	//
+	struct dead_flag_statistics
+	{
+		size_t flag_writes = 0;
+		size_t temporary_writes = 0;
+
+		dead_flag_statistics& operator+=( const dead_flag_statistics& o )
+		{
+			flag_writes += o.flag_writes;
+			temporary_writes += o.temporary_writes;
+			return *this;
+		}
+	};
+
+	// Removes the writes to the flags register that are overwritten before they are read, along
+	// with the temporaries only feeding them. Runs a single backwards liveness scan over the block
+	// and is meant to be used right after lifting, to keep the instructions the lifter emits for
+	// every flag from reaching the branch analysis.
+	//
+	inline dead_flag_statistics eliminate_dead_flags( basic_block* block )
+	{
+		dead_flag_statistics stats = {};
+
+		// Flags are live at the end of the block, temporaries are not.
+		//
+		uint64_t live_flags = ~0ull;
+		std::unordered_map<uint64_t, uint64_t> live_temporaries;
+
+		auto mark_read = [ & ] ( const register_desc& reg )
+		{
+			if ( reg.is_flags() )
+				live_flags |= reg.get_mask();
+			else if ( reg.is_local() )
+				live_temporaries[ reg.local_id ] |= reg.get_mask();
+		};
+
+		for ( auto it = block->end(); it != block->begin(); )
+		{
+			--it;
+			const instruction& ins = *it;
+
+			// Anything with side effects may observe the flags.
+			//
+			if ( ins.is_volatile() || ins.base->is_branching() )
+				live_flags = ~0ull;
+
+			// If the instruction writes to a flag or a temporary without any other effect, check if
+			// the value is still needed.
+			//
+			if ( !ins.is_volatile() && !ins.base->writes_memory() && !ins.operands.empty() &&
+				 ins.base->operand_types[ 0 ] >= operand_type::write && ins.operands[ 0 ].is_register() )
+			{
+				const register_desc& dst = ins.operands[ 0 ].reg();
+				uint64_t* live = nullptr;
+				if ( dst.is_flags() )
+					live = &live_flags;
+				else if ( dst.is_local() )
+					live = &live_temporaries[ dst.local_id ];
+
+				if ( live )
+				{
+					if ( !( *live & dst.get_mask() ) )
+					{
+						++( dst.is_flags() ? stats.flag_writes : stats.temporary_writes );
+						it = block->erase( it );
+						continue;
+					}
+
+					// A plain write kills the previous value.
+					//
+					if ( ins.base->operand_types[ 0 ] == operand_type::write )
+						*live &= ~dst.get_mask();
+				}
+			}
+
+			// Propagate the reads.
+			//
+			for ( size_t i = 0; i != ins.operands.size(); i++ )
+			{
+				if ( ins.operands[ i ].is_register() && ins.base->operand_types[ i ] != operand_type::write )
+					mark_read( ins.operands[ i ].reg() );
+			}
+		}
+		return stats;
+	}
+};
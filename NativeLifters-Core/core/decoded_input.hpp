@@ -0,0 +1,135 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <vector>
+#include <optional>
+#include <shared_mutex>
+#include "recursive_descent.hpp"
+
+namespace vtil::lifter
+{
+	// Byte input that keeps every instruction it has decoded so that bytes reached
+	// more than once, either within a single exploration or across several of them,
+	// are only ever disassembled once.
+	//
+	template<typename arch>
+	struct decoded_input : byte_input
+	{
+		using instruction_info = typename arch::instruction_info;
+		using decoder_t = typename arch::decoder_t;
+
+		// Values of the slot index that do not refer to a record.
+		//
+		static constexpr uint32_t slot_unknown = 0;
+		static constexpr uint32_t slot_invalid = 1;
+		static constexpr uint32_t slot_first_record = 2;
+
+		// Decoded instructions stored contiguously, records released by invalidate are reused.
+		//
+		mutable std::vector<instruction_info> records;
+		mutable std::vector<uint32_t> free_records;
+
+		// Maps each byte of the input, indexed by its offset from the base, to the state of the
+		// instruction starting at it: not decoded yet, not decodable, or the record holding it.
+		//
+		mutable std::vector<uint32_t> slots;
+
+		// Guards the cache, lookups may run concurrently from several exploration workers.
+		//
+		mutable std::shared_mutex lock;
+
+		// Constructor.
+		//
+		decoded_input( const byte_input& input ) : byte_input( input ), slots( input.size, slot_unknown ) {}
+
+		// Returns a copy of the instruction at the given address, decoding it with the given decoder on
+		// first use. Decoding happens outside of the lock, if two workers race the first result is kept.
+		//
+		std::optional<instruction_info> decode( vip_t vip, decoder_t& decoder ) const
+		{
+			if ( !is_valid( vip ) )
+				return std::nullopt;
+			uint32_t& slot = slots[ vip - base ];
+
+			{
+				std::shared_lock _g( lock );
+				if ( slot == slot_invalid )
+					return std::nullopt;
+				if ( slot != slot_unknown )
+					return records[ slot - slot_first_record ];
+			}
+
+			auto insn = arch::decode( decoder, vip, get_at( vip ), get_remaining( vip ) );
+
+			std::unique_lock _g( lock );
+			if ( slot == slot_unknown )
+			{
+				if ( !insn )
+				{
+					slot = slot_invalid;
+				}
+				else if ( !free_records.empty() )
+				{
+					slot = free_records.back() + slot_first_record;
+					free_records.pop_back();
+					records[ slot - slot_first_record ] = *insn;
+				}
+				else
+				{
+					slot = uint32_t( records.size() ) + slot_first_record;
+					records.push_back( *insn );
+				}
+			}
+
+			if ( slot == slot_invalid )
+				return std::nullopt;
+			return records[ slot - slot_first_record ];
+		}
+
+		// Forgets the instructions that may overlap the bytes in [begin, end) after they were
+		// patched, their records are reused by the instructions decoded next.
+		//
+		void invalidate( vip_t begin, vip_t end ) const
+		{
+			constexpr vip_t max_instruction_length = 15;
+
+			begin = begin >= base + max_instruction_length ? begin - max_instruction_length + 1 : base;
+			end = std::min<vip_t>( end, base + size );
+
+			std::unique_lock _g( lock );
+			for ( vip_t vip = begin; vip < end; vip++ )
+			{
+				uint32_t& slot = slots[ vip - base ];
+				if ( slot >= slot_first_record )
+					free_records.push_back( slot - slot_first_record );
+				slot = slot_unknown;
+			}
+		}
+	};
+};
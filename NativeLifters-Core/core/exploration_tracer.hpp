@@ -0,0 +1,73 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <vtil/compiler>
+#include <unordered_map>
+
+namespace vtil::lifter
+{
+	// Counters describing how often traces were served from the cache.
+	//
+	struct tracer_statistics
+	{
+		size_t hits = 0;
+		size_t misses = 0;
+
+		tracer_statistics& operator+=( const tracer_statistics& o )
+		{
+			hits += o.hits;
+			misses += o.misses;
+			return *this;
+		}
+	};
+
+	// Cached tracer kept for a whole exploration rather than a single block, so that the
+	// predecessors traced into by the branch analysis of one block are not traced again for
+	// the next. Entries are only dropped for the blocks whose instructions change.
+	//
+	struct exploration_tracer : cached_tracer
+	{
+		tracer_statistics stats;
+
+		// Counts the lookups before forwarding them to the cache.
+		//
+		symbolic::expression::reference trace( const symbolic::variable& lookup ) override
+		{
+			++( cache.contains( lookup ) ? stats.hits : stats.misses );
+			return cached_tracer::trace( lookup );
+		}
+
+		// Drops every trace taken at a position within the given block.
+		//
+		void invalidate( const basic_block* block )
+		{
+			std::erase_if( cache, [ & ] ( const auto& entry ) { return entry.first.at.block == block; } );
+		}
+	};
+};
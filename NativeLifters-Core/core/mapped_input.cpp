@@ -0,0 +1,283 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "mapped_input.hpp"
+#include <cstring>
+#include <optional>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vtil::lifter
+{
+	// Reads a little endian value of the given width from the view, if it is within bounds.
+	//
+	template<typename T>
+	static std::optional<uint64_t> read( const uint8_t* view, size_t view_size, uint64_t offset )
+	{
+		if ( offset > view_size || view_size - offset < sizeof( T ) )
+			return std::nullopt;
+		T value;
+		memcpy( &value, view + offset, sizeof( T ) );
+		return ( uint64_t ) value;
+	}
+
+	// Reads a zero terminated string from the view, truncated at its end.
+	//
+	static std::string read_string( const uint8_t* view, size_t view_size, uint64_t offset, size_t max_length )
+	{
+		std::string result;
+		for ( ; offset < view_size && result.size() < max_length && view[ offset ]; offset++ )
+			result.push_back( ( char ) view[ offset ] );
+		return result;
+	}
+
+	std::unique_ptr<mapped_input> mapped_input::open( const std::filesystem::path& path )
+	{
+		std::unique_ptr<mapped_input> input{ new mapped_input() };
+
+#ifdef _WIN32
+		HANDLE file = CreateFileW( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+		if ( file == INVALID_HANDLE_VALUE )
+			return nullptr;
+
+		LARGE_INTEGER size;
+		HANDLE mapping = nullptr;
+		if ( GetFileSizeEx( file, &size ) && size.QuadPart )
+			mapping = CreateFileMappingW( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+		CloseHandle( file );
+		if ( !mapping )
+			return nullptr;
+
+		input->mapping_handle = mapping;
+		input->view = ( const uint8_t* ) MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+		input->view_size = ( size_t ) size.QuadPart;
+		if ( !input->view )
+			return nullptr;
+#else
+		int fd = ::open( path.c_str(), O_RDONLY );
+		if ( fd < 0 )
+			return nullptr;
+
+		struct stat st;
+		void* view = MAP_FAILED;
+		if ( fstat( fd, &st ) == 0 && st.st_size > 0 )
+			view = mmap( nullptr, ( size_t ) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		close( fd );
+		if ( view == MAP_FAILED )
+			return nullptr;
+
+		input->view = ( const uint8_t* ) view;
+		input->view_size = ( size_t ) st.st_size;
+#endif
+
+		if ( !input->parse_elf() && !input->parse_pe() )
+			return nullptr;
+
+		std::sort( input->sections.begin(), input->sections.end(), [ ] ( const section& a, const section& b ) { return a.begin < b.begin; } );
+		return input;
+	}
+
+	mapped_input::~mapped_input()
+	{
+#ifdef _WIN32
+		if ( view )
+			UnmapViewOfFile( view );
+		if ( mapping_handle )
+			CloseHandle( mapping_handle );
+#else
+		if ( view )
+			munmap( ( void* ) view, view_size );
+#endif
+	}
+
+	void mapped_input::add_section( std::string name, vip_t address, uint64_t file_offset, uint64_t size )
+	{
+		if ( !size || file_offset > view_size || view_size - file_offset < size )
+			return;
+
+		// Sections overlapping one already added are dropped so that lookups stay unambiguous.
+		//
+		for ( auto& s : sections )
+		{
+			if ( address < s.end && s.begin < address + size )
+				return;
+		}
+		sections.push_back( { std::move( name ), address, address + size, view + file_offset } );
+	}
+
+	bool mapped_input::parse_elf()
+	{
+		auto read_u8 = [ & ] ( uint64_t offset ) { return read<uint8_t>( view, view_size, offset ); };
+		auto read_u16 = [ & ] ( uint64_t offset ) { return read<uint16_t>( view, view_size, offset ); };
+		auto read_u32 = [ & ] ( uint64_t offset ) { return read<uint32_t>( view, view_size, offset ); };
+		auto read_u64 = [ & ] ( uint64_t offset ) { return read<uint64_t>( view, view_size, offset ); };
+
+		if ( view_size < 0x34 || memcmp( view, "\x7F" "ELF", 4 ) || *read_u8( 5 ) != 1 )
+			return false;
+
+		// Layout of the headers depends on the class, offsets below are { ELF32, ELF64 }.
+		//
+		const bool is_64 = *read_u8( 4 ) == 2;
+		auto read_word = [ & ] ( uint64_t offset ) { return is_64 ? read_u64( offset ) : read_u32( offset ); };
+		auto pick = [ & ] ( uint64_t off32, uint64_t off64 ) { return is_64 ? off64 : off32; };
+
+		auto entry = read_word( 24 );
+		auto phoff = read_word( pick( 28, 32 ) );
+		auto shoff = read_word( pick( 32, 40 ) );
+		auto phentsize = read_u16( pick( 42, 54 ) );
+		auto phnum = read_u16( pick( 44, 56 ) );
+		auto shentsize = read_u16( pick( 46, 58 ) );
+		auto shnum = read_u16( pick( 48, 60 ) );
+		auto shstrndx = read_u16( pick( 50, 62 ) );
+		if ( !entry || !phoff || !shoff || !phentsize || !phnum || !shentsize || !shnum || !shstrndx )
+			return false;
+		entry_point = *entry;
+
+		// The image base is the lowest loaded address.
+		//
+		constexpr uint32_t pt_load = 1;
+		constexpr uint32_t pf_x = 1;
+		base = ~0ull;
+		for ( uint64_t i = 0; i != *phnum; i++ )
+		{
+			uint64_t ph = *phoff + i * *phentsize;
+			if ( read_u32( ph ) == pt_load )
+				base = std::min( base, read_word( ph + pick( 8, 16 ) ).value_or( ~0ull ) );
+		}
+		if ( base == ~0ull )
+			base = 0;
+
+		// Prefer the section headers, they are more precise than the segments.
+		//
+		constexpr uint32_t sht_nobits = 8;
+		constexpr uint64_t shf_execinstr = 4;
+		auto strtab = read_word( *shoff + *shstrndx * *shentsize + pick( 16, 24 ) );
+		for ( uint64_t i = 0; i != *shnum; i++ )
+		{
+			uint64_t sh = *shoff + i * *shentsize;
+			auto name = read_u32( sh );
+			auto type = read_u32( sh + 4 );
+			auto flags = read_word( sh + 8 );
+			auto addr = read_word( sh + pick( 12, 16 ) );
+			auto offset = read_word( sh + pick( 16, 24 ) );
+			auto size = read_word( sh + pick( 20, 32 ) );
+			if ( !name || !type || !flags || !addr || !offset || !size )
+				return false;
+			if ( *type == sht_nobits || !( *flags & shf_execinstr ) )
+				continue;
+
+			add_section( strtab ? read_string( view, view_size, *strtab + *name, 64 ) : std::string{}, *addr, *offset, *size );
+		}
+
+		// Stripped images may only have segments.
+		//
+		if ( sections.empty() )
+		{
+			for ( uint64_t i = 0; i != *phnum; i++ )
+			{
+				uint64_t ph = *phoff + i * *phentsize;
+				auto type = read_u32( ph );
+				auto flags = read_u32( ph + pick( 24, 4 ) );
+				auto offset = read_word( ph + pick( 4, 8 ) );
+				auto vaddr = read_word( ph + pick( 8, 16 ) );
+				auto filesz = read_word( ph + pick( 16, 32 ) );
+				if ( !type || !flags || !offset || !vaddr || !filesz )
+					return false;
+				if ( *type == pt_load && ( *flags & pf_x ) )
+					add_section( {}, *vaddr, *offset, *filesz );
+			}
+		}
+		return true;
+	}
+
+	bool mapped_input::parse_pe()
+	{
+		auto read_u16 = [ & ] ( uint64_t offset ) { return read<uint16_t>( view, view_size, offset ); };
+		auto read_u32 = [ & ] ( uint64_t offset ) { return read<uint32_t>( view, view_size, offset ); };
+		auto read_u64 = [ & ] ( uint64_t offset ) { return read<uint64_t>( view, view_size, offset ); };
+
+		if ( view_size < 0x40 || memcmp( view, "MZ", 2 ) )
+			return false;
+
+		auto nt = read_u32( 0x3C );
+		if ( !nt || *nt > view_size - 4 || memcmp( view + *nt, "PE\0\0", 4 ) )
+			return false;
+
+		uint64_t file_header = *nt + 4;
+		uint64_t optional_header = file_header + 20;
+		auto section_count = read_u16( file_header + 2 );
+		auto optional_size = read_u16( file_header + 16 );
+		auto magic = read_u16( optional_header );
+		auto entry = read_u32( optional_header + 16 );
+		if ( !section_count || !optional_size || !magic || !entry )
+			return false;
+
+		constexpr uint16_t pe32_magic = 0x10B;
+		constexpr uint16_t pe32_plus_magic = 0x20B;
+		std::optional<uint64_t> image_base;
+		if ( *magic == pe32_plus_magic )
+			image_base = read_u64( optional_header + 24 );
+		else if ( *magic == pe32_magic )
+			image_base = read_u32( optional_header + 28 );
+		if ( !image_base )
+			return false;
+		base = *image_base;
+		entry_point = base + *entry;
+
+		// Bytes past the raw data of a section are zero filled at runtime and not exposed.
+		//
+		constexpr uint32_t scn_cnt_code = 0x00000020;
+		constexpr uint32_t scn_mem_execute = 0x20000000;
+		uint64_t section_table = optional_header + *optional_size;
+		for ( uint64_t i = 0; i != *section_count; i++ )
+		{
+			uint64_t sh = section_table + i * 40;
+			auto virtual_size = read_u32( sh + 8 );
+			auto virtual_address = read_u32( sh + 12 );
+			auto raw_size = read_u32( sh + 16 );
+			auto raw_offset = read_u32( sh + 20 );
+			auto characteristics = read_u32( sh + 36 );
+			if ( !virtual_size || !virtual_address || !raw_size || !raw_offset || !characteristics )
+				return false;
+			if ( !( *characteristics & ( scn_cnt_code | scn_mem_execute ) ) )
+				continue;
+
+			uint64_t size = *virtual_size ? std::min( *virtual_size, *raw_size ) : *raw_size;
+			add_section( read_string( view, view_size, sh, 8 ), base + *virtual_address, *raw_offset, size );
+		}
+		return true;
+	}
+};
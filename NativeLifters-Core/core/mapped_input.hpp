@@ -0,0 +1,123 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vtil::lifter
+{
+	// Input descriptor backed by a read-only memory mapping of an ELF or PE image. Only the
+	// executable sections are exposed at the addresses they are loaded at, every other byte
+	// is invalid. Pages are only read from the file once they are lifted from.
+	//
+	struct mapped_input
+	{
+		// An executable section, [begin, end) mapped to the file bytes starting at data.
+		//
+		struct section
+		{
+			std::string name;
+			vip_t begin;
+			vip_t end;
+			const uint8_t* data;
+		};
+
+		// Executable sections sorted by address, they never overlap.
+		//
+		std::vector<section> sections;
+
+		// Preferred load address and entry point of the image.
+		//
+		uint64_t base = 0;
+		uint64_t entry_point = 0;
+
+		// Maps the file at the given path and parses its headers, returns null if it could not be
+		// mapped or is neither an ELF nor a PE image.
+		//
+		static std::unique_ptr<mapped_input> open( const std::filesystem::path& path );
+
+		// Unmaps the file.
+		//
+		~mapped_input();
+		mapped_input( const mapped_input& ) = delete;
+		mapped_input& operator=( const mapped_input& ) = delete;
+
+		// Finds the section containing the given address in logarithmic time.
+		//
+		const section* find_section( vip_t vip ) const
+		{
+			auto it = std::upper_bound( sections.begin(), sections.end(), vip, [ ] ( vip_t address, const section& s ) { return address < s.begin; } );
+			if ( it == sections.begin() || vip >= ( --it )->end )
+				return nullptr;
+			return &*it;
+		}
+
+		bool is_valid( vip_t vip ) const
+		{
+			return find_section( vip ) != nullptr;
+		}
+
+		// The mapping is read-only, the lifter never writes through the pointer.
+		//
+		uint8_t* get_at( vip_t vip ) const
+		{
+			auto s = find_section( vip );
+			dassert( s );
+			return const_cast< uint8_t* >( s->data + ( vip - s->begin ) );
+		}
+
+		uint64_t get_remaining( vip_t vip ) const
+		{
+			auto s = find_section( vip );
+			dassert( s );
+			return s->end - vip;
+		}
+
+	private:
+		// View of the whole file.
+		//
+		const uint8_t* view = nullptr;
+		size_t view_size = 0;
+		void* mapping_handle = nullptr;
+
+		mapped_input() = default;
+
+		// Collects the executable sections out of the headers, returns false if they are malformed.
+		//
+		bool parse_elf();
+		bool parse_pe();
+
+		// Adds the section if its bytes lie within the file.
+		//
+		void add_section( std::string name, vip_t address, uint64_t file_offset, uint64_t size );
+	};
+};
@@ -27,6 +27,7 @@
 //
 #pragma once
 #include <vtil/arch>
+#include "block_translator.hpp"
 
 namespace vtil::lifter
 {
@@ -35,7 +36,7 @@ namespace vtil::lifter
 	struct operative : math::operable<operative>
 	{
 		operand op;
-		inline static thread_local batch_translator* translator = nullptr;
+		inline static thread_local block_translator* translator = nullptr;
 
 		template<typename T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
 		operative( T value )
@@ -53,7 +54,7 @@ namespace vtil::lifter
 				? symbolic::CTX[ rhs.op.reg() ]
 				: symbolic::expression{ rhs.op.imm().u64, rhs.op.bit_count() };
 
-			op = *translator << symbolic::variable::pack_all( symbolic::expression{ elhs, opr, erhs } );
+			op = translator->translate( symbolic::variable::pack_all( symbolic::expression{ elhs, opr, erhs } ), { &lhs.op, &rhs.op } );
 		}
 
 		operative( math::operator_id opr, const operative& rhs )
@@ -62,7 +63,16 @@ namespace vtil::lifter
 				? symbolic::CTX[ rhs.op.reg() ]
 				: symbolic::expression{ rhs.op.imm().u64, rhs.op.bit_count() };
 
-			op = *translator << symbolic::variable::pack_all( symbolic::expression{ opr, erhs } );
+			op = translator->translate( symbolic::variable::pack_all( symbolic::expression{ opr, erhs } ), { &rhs.op } );
+		}
+
+		// Evaluates to lhs if the condition is set and to rhs otherwise. Formed as a single masked
+		// difference rather than the union of two masked values, so that the simplifier does not
+		// have to recognize the two halves as exclusive.
+		//
+		static operative select( const operative& condition, const operative& lhs, const operative& rhs )
+		{
+			return rhs ^ __if( condition, lhs ^ rhs );
 		}
 
 		bitcnt_t bit_count()
@@ -26,11 +26,77 @@
 // POSSIBILITY OF SUCH DAMAGE.        
 //
 #pragma once
+#include <chrono>
 
 namespace vtil::lifter
 {
+	// Reason an exploration stopped for.
+	//
+	enum class exploration_status
+	{
+		complete,
+		block_limit,
+		instruction_limit,
+		il_limit,
+		time_limit,
+	};
+
+	// Order in which the forked blocks are lifted during exploration.
+	//
+	enum class exploration_order
+	{
+		depth_first,
+		breadth_first,
+		address_order,
+	};
+
 	struct processing_flags
 	{
 		bool inline_calls = false;
+
+		// Sweep the code with the length pre-decoder before lifting to discover the
+		// block boundaries reachable through direct branches.
+		//
+		bool predecode_leaders = false;
+
+		// Record the operation producing the status flags and only compute the individual
+		// flags when they are observed or the block ends.
+		//
+		bool lazy_flags = false;
+
+		// Write the status flags produced by an instruction to the flags register at once
+		// rather than one flag at a time.
+		//
+		bool coalesce_flags = false;
+
+		// Remove flag writes overwritten before being read from each block once it is lifted.
+		//
+		bool eliminate_dead_flags = true;
+
+		// Update RIP before every instruction rather than only where it is observed.
+		//
+		bool always_update_rip = false;
+
+		// Replay the IL lifted for an earlier instruction with the same encoding instead of
+		// running its handler again, where the handler does not depend on the instructions
+		// preceding it.
+		//
+		bool replay_templates = true;
+
+		// Order in which the blocks discovered are lifted.
+		//
+		exploration_order order = exploration_order::depth_first;
+
+		// Number of threads lifting blocks concurrently, zero uses one per hardware thread.
+		//
+		size_t worker_count = 1;
+
+		// Budgets of a single exploration, zero for no limit. Once one is exhausted the blocks not
+		// lifted yet are turned into vexits and the exploration reports which one it was.
+		//
+		size_t max_blocks = 0;
+		size_t max_instructions = 0;
+		size_t max_il_instructions = 0;
+		std::chrono::milliseconds time_limit = {};
 	};
 };
\ No newline at end of file
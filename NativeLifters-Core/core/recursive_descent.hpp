@@ -31,7 +31,19 @@
 
 #include <unordered_set>
 #include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include "processing_flags.hpp"
+#include "dead_flag_elimination.hpp"
+#include "worklist.hpp"
+#include "block_index.hpp"
+#include "exploration_tracer.hpp"
 
 namespace vtil::lifter
 {
@@ -51,13 +63,43 @@ namespace vtil::lifter
 			dassert( is_valid( vip ) );
 			return &bytes[ vip - base ];
 		}
-	};
 
+		uint64_t get_remaining( vip_t vip ) const
+		{
+			dassert( is_valid( vip ) );
+			return size - ( vip - base );
+		}
+	};
 	// Generic recursive descent parser used for exploring control flow.
 	//
 	template<typename input_type, typename arch>
 	struct recursive_descent
 	{
+		// State owned by each thread lifting blocks.
+		//
+		struct worker_state
+		{
+			// Decoder context used to disassemble instructions.
+			//
+			typename arch::decoder_t decoder;
+
+			// Blocks forked by this worker but not lifted yet, other workers steal from
+			// it when they run out of their own.
+			//
+			block_worklist worklist;
+			std::mutex worklist_lock;
+
+			// Number of instructions removed by dead flag elimination.
+			//
+			dead_flag_statistics dead_flag_stats;
+
+			// Tracer used for the branch analysis of every block this worker lifts.
+			//
+			exploration_tracer tracer;
+
+			worker_state( exploration_order order ) : worklist( order ) {}
+		};
+
 		// Input descriptor.
 		//
 		const input_type* input;
@@ -70,9 +112,69 @@ namespace vtil::lifter
 		//
 		std::unique_ptr<routine> owner_rtn;
 
-		// Instructions corresponding to their basic blocks.
+		// Instructions corresponding to their basic blocks, discovered leaders
+		// that are not lifted yet are mapped to nullptr.
 		//
 		std::unordered_map<uint64_t, basic_block*> leaders;
+		mutable std::shared_mutex leaders_lock;
+
+		// Held shared while tracing across blocks and exclusively while linking blocks into
+		// the routine, since forking changes the predecessor lists the tracer walks.
+		//
+		std::shared_mutex link_lock;
+
+		// Address ranges of the completed blocks, guarded by the link lock.
+		//
+		block_index index;
+
+		// Blocks whose destinations were resolved by tracing into their predecessors, guarded
+		// by the link lock.
+		//
+		std::unordered_set<const basic_block*> traced_blocks;
+
+		// Called with every block once it is complete and linked to its successors, from the
+		// worker that lifted it and thus possibly from several threads at once. Blocks may be
+		// optimized while the exploration continues through modify_block.
+		//
+		std::function<void( basic_block* )> on_block_complete;
+
+		// Blocks handed to the observer, which are never split afterwards. Guarded by the link lock.
+		//
+		std::unordered_set<const basic_block*> published_blocks;
+
+		// Workers, the first one runs on the calling thread.
+		//
+		std::deque<worker_state> workers;
+
+		// Number of blocks queued or being lifted.
+		//
+		std::atomic<size_t> pending_blocks = 0;
+
+		// Workers without anything to take wait on the condition until a block is queued, which
+		// bumps the epoch, or until every block is lifted.
+		//
+		std::mutex idle_lock;
+		std::condition_variable idle_cv;
+		size_t queue_epoch = 0;
+
+		// Number of instructions removed by dead flag elimination.
+		//
+		dead_flag_statistics dead_flag_stats;
+
+		// Cache hits and misses of the tracers used for branch analysis.
+		//
+		tracer_statistics tracer_stats;
+
+		// Work done by the current exploration, checked against the budgets.
+		//
+		std::atomic<size_t> lifted_blocks = 0;
+		std::atomic<size_t> lifted_instructions = 0;
+		std::atomic<size_t> lifted_il_instructions = 0;
+		std::chrono::steady_clock::time_point deadline;
+
+		// First budget exhausted by the current exploration.
+		//
+		std::atomic<exploration_status> status = exploration_status::complete;
 
 		// Constructor.
 		//
@@ -83,95 +185,668 @@ namespace vtil::lifter
 
 			entry->owner->alloc( 64 ); // reserve one internal for RIP.
 			entry->owner->context.get<processing_flags>() = flags;
+
+			size_t worker_count = flags.worker_count ? flags.worker_count : std::max( std::thread::hardware_concurrency(), 1u );
+			for ( size_t n = 0; n != worker_count; n++ )
+				workers.emplace_back( flags.order );
+		}
+
+		// Lifts a single instruction, going through the decode cache of the input if it has one.
+		//
+		size_t process( worker_state& worker, basic_block* block, vip_t vip, uint8_t* code )
+		{
+			if constexpr ( requires { input->decode( vip, worker.decoder ); } )
+			{
+				if ( auto insn = input->decode( vip, worker.decoder ) )
+					return arch::process( block, *insn );
+			}
+			return arch::process( block, worker.decoder, vip, code, input->get_remaining( vip ) );
+		}
+
+		// Lets the architecture complete any deferred state before the block is terminated.
+		//
+		void end_block( basic_block* block )
+		{
+			if constexpr ( requires { arch::end_block( block ); } )
+				arch::end_block( block );
+		}
+
+		// Checks if the block can be split right before the instruction at the given address
+		// once it is lifted, any address can if the architecture does not defer state.
+		//
+		bool is_boundary( basic_block* block, vip_t vip )
+		{
+			if constexpr ( requires { arch::is_boundary( block, vip ); } )
+				return arch::is_boundary( block, vip );
+			else
+				return true;
+		}
+
+		// Lets the architecture drop the state it would otherwise carry past the boundary just
+		// recorded, which would keep the block from being split there.
+		//
+		void mark_boundary( basic_block* block )
+		{
+			if constexpr ( requires { arch::mark_boundary( block ); } )
+				arch::mark_boundary( block );
+		}
+
+		// Returns the destinations of the branch terminating the block if the architecture took
+		// them from the decoded instruction, empty if the branch has to be traced.
+		//
+		std::vector<vip_t> direct_targets( basic_block* block )
+		{
+			if constexpr ( requires { arch::direct_targets( block ); } )
+				return arch::direct_targets( block );
+			else
+				return {};
+		}
+
+		// Records the range lifted into a completed block so that branches landing inside of it
+		// split it. Requires the link lock to be held exclusively.
+		//
+		void record_block( basic_block* block, vip_t end, std::vector<vip_t>& boundaries )
+		{
+			lifted_il_instructions += block->size();
+			if ( end != block->entry_vip )
+				index.insert( block, block->entry_vip, end, std::move( boundaries ) );
+		}
+
+		// Marks the block as about to be handed to the observer so that it is no longer split.
+		// Requires the link lock to be held exclusively.
+		//
+		void mark_published( basic_block* block )
+		{
+			if ( on_block_complete )
+				published_blocks.insert( block );
+		}
+
+		// Checks the budgets given the instructions of the block being lifted, recording the first
+		// one exhausted. Nothing is lifted once any of them is.
+		//
+		bool is_over_budget( size_t pending_il_instructions = 0 )
+		{
+			if ( status != exploration_status::complete )
+				return true;
+
+			const auto& flags = entry->owner->context.get<processing_flags>();
+			exploration_status reason;
+			if ( flags.max_blocks && lifted_blocks >= flags.max_blocks )
+				reason = exploration_status::block_limit;
+			else if ( flags.max_instructions && lifted_instructions >= flags.max_instructions )
+				reason = exploration_status::instruction_limit;
+			else if ( flags.max_il_instructions && lifted_il_instructions + pending_il_instructions >= flags.max_il_instructions )
+				reason = exploration_status::il_limit;
+			else if ( flags.time_limit.count() && std::chrono::steady_clock::now() >= deadline )
+				reason = exploration_status::time_limit;
+			else
+				return false;
+
+			auto expected = exploration_status::complete;
+			status.compare_exchange_strong( expected, reason );
+			return true;
+		}
+
+		// Hands a completed block to the observer, must be called without holding the link lock.
+		//
+		void notify( basic_block* block )
+		{
+			if ( on_block_complete )
+				on_block_complete( block );
+		}
+
+		// Runs the function on a completed block while no branch analysis can trace into it, and
+		// drops the traces taken within it afterwards. Meant for observers changing the blocks
+		// they are handed while the exploration continues.
+		//
+		template<typename F>
+		void modify_block( basic_block* block, F&& fn )
+		{
+			std::unique_lock _g( link_lock );
+			fn( block );
+			invalidate( block );
+		}
+
+		// Drops the traces taken within a block whose instructions or predecessors changed.
+		// Requires the link lock to be held exclusively or no worker to be running.
+		//
+		void invalidate( const basic_block* block )
+		{
+			for ( auto& worker : workers )
+				worker.tracer.invalidate( block );
+		}
+
+		// Splits the lifted block the address lands inside of if there is one, so that its code
+		// is not lifted a second time. Requires the link lock to be held exclusively or no worker
+		// to be running.
+		//
+		basic_block* split_at( vip_t vip )
+		{
+			if ( auto range = index.find_inside( vip ); !range || published_blocks.contains( range->block ) )
+				return nullptr;
+
+			auto next_blk = index.split_at( vip );
+			if ( next_blk )
+			{
+				invalidate( next_blk->prev.front() );
+				add_leader( next_blk );
+			}
+			return next_blk;
+		}
+
+		// Makes the block a leader so that blocks lifted from then on end at its entry rather
+		// than running into its code.
+		//
+		void add_leader( basic_block* block )
+		{
+			std::unique_lock _g( leaders_lock );
+			leaders[ block->entry_vip ] = block;
+		}
+
+		// Forks the block into the destination, returns the new block if it did not exist yet.
+		// The new block is a leader from here on, even before it is lifted. Requires the link
+		// lock to be held exclusively.
+		//
+		basic_block* fork( basic_block* block, vip_t vip )
+		{
+			auto next_blk = block->fork( vip );
+			if ( next_blk )
+				add_leader( next_blk );
+			else if ( auto existing = owner_rtn->find_block( vip ) )
+				invalidate( existing );
+			return next_blk;
+		}
+
+		// Returns whether the given address starts a known block.
+		//
+		bool is_leader( vip_t vip ) const
+		{
+			std::shared_lock _g( leaders_lock );
+			return leaders.contains( vip );
+		}
+
+		// Queues a block on the worker.
+		//
+		void push( worker_state& worker, basic_block* block )
+		{
+			pending_blocks++;
+			{
+				std::lock_guard _g( worker.worklist_lock );
+				worker.worklist.push( block );
+			}
+			wake_workers( 1 );
+		}
+
+		// Wakes up idle workers after the given number of blocks was queued.
+		//
+		void wake_workers( size_t count )
+		{
+			{
+				std::lock_guard _g( idle_lock );
+				queue_epoch++;
+			}
+			if ( count == 1 )
+				idle_cv.notify_one();
+			else
+				idle_cv.notify_all();
+		}
+
+		// Takes the next block from the worker's own queue, stealing from the others if it is empty.
+		//
+		basic_block* take( worker_state& worker )
+		{
+			{
+				std::lock_guard _g( worker.worklist_lock );
+				if ( !worker.worklist.empty() )
+					return worker.worklist.pop();
+			}
+			for ( auto& victim : workers )
+			{
+				if ( &victim == &worker )
+					continue;
+				std::lock_guard _g( victim.worklist_lock );
+				if ( !victim.worklist.empty() )
+					return victim.worklist.steal();
+			}
+			return nullptr;
+		}
+
+		// Lifts blocks until every queued block is lifted.
+		//
+		void run_worker( worker_state& worker )
+		{
+			while ( pending_blocks )
+			{
+				// Note the epoch before looking for work so that a block queued in between is not missed.
+				//
+				size_t epoch;
+				{
+					std::lock_guard _g( idle_lock );
+					epoch = queue_epoch;
+				}
+
+				if ( auto block = take( worker ) )
+				{
+					lift_block( worker, block );
+					if ( --pending_blocks == 0 )
+					{
+						std::lock_guard _g( idle_lock );
+						idle_cv.notify_all();
+					}
+				}
+				else
+				{
+					std::unique_lock _g( idle_lock );
+					idle_cv.wait( _g, [ & ] { return queue_epoch != epoch || !pending_blocks; } );
+				}
+			}
+		}
+
+		// Sweeps the code reachable through direct control flow using the length pre-decoder of
+		// the architecture and seeds the leader map with the block boundaries found, so that
+		// blocks are split before they are lifted. The sweep starts from the given addresses, or
+		// from the entry block if there are none. Returns the number of instructions visited.
+		//
+		size_t discover_leaders( std::vector<vip_t> worklist = {} )
+		{
+			const bool follow_calls = entry->owner->context.get<processing_flags>().inline_calls;
+
+			if ( worklist.empty() )
+				worklist.push_back( entry->entry_vip );
+			for ( vip_t root : worklist )
+				leaders.try_emplace( root, nullptr );
+
+			std::unordered_set<vip_t> visited;
+			size_t count = 0;
+
+			while ( !worklist.empty() )
+			{
+				vip_t vip = worklist.back();
+				worklist.pop_back();
+
+				while ( input->is_valid( vip ) && visited.insert( vip ).second )
+				{
+					auto info = arch::predecode( vip, input->get_at( vip ), input->get_remaining( vip ) );
+					if ( !info.length )
+						break;
+					count++;
+					vip += info.length;
+
+					if ( !info.is_branch )
+						continue;
+
+					// Direct destinations start a new block, calls only do so if they are inlined.
+					//
+					if ( info.target && input->is_valid( *info.target ) && ( !info.is_call || follow_calls ) )
+					{
+						leaders.try_emplace( *info.target, nullptr );
+						worklist.push_back( *info.target );
+					}
+
+					// So does the instruction following a branch.
+					//
+					if ( !info.has_fallthrough() )
+						break;
+					leaders.try_emplace( vip, nullptr );
+				}
+			}
+			return count;
 		}
 
-		// Start recursive descent.
+		// Lifts the given blocks and every block reachable from them. Blocks are lifted one at a
+		// time off the worklists so the exploration depth is not bound by the stack, and by
+		// as many threads as there are workers. The budgets apply to each call separately,
+		// returns the one exhausted if any.
 		//
-		void populate( basic_block* start_block )
+		exploration_status populate( const std::vector<basic_block*>& start_blocks )
+		{
+			lifted_blocks = 0;
+			lifted_instructions = 0;
+			lifted_il_instructions = 0;
+			deadline = std::chrono::steady_clock::now() + entry->owner->context.get<processing_flags>().time_limit;
+			status = exploration_status::complete;
+
+			for ( auto start_block : start_blocks )
+			{
+				add_leader( start_block );
+				push( workers.front(), start_block );
+			}
+
+			std::vector<std::thread> threads;
+			for ( auto it = std::next( workers.begin() ); it != workers.end(); ++it )
+				threads.emplace_back( [ this, &worker = *it ] () { run_worker( worker ); } );
+			run_worker( workers.front() );
+			for ( auto& thread : threads )
+				thread.join();
+
+			for ( auto& worker : workers )
+			{
+				dead_flag_stats += worker.dead_flag_stats;
+				worker.dead_flag_stats = {};
+				tracer_stats += worker.tracer.stats;
+				worker.tracer.stats = {};
+			}
+			return status;
+		}
+		exploration_status populate( basic_block* start_block )
+		{
+			return populate( std::vector{ start_block } );
+		}
+
+		// Lifts a single block and queues the blocks it branches to.
+		//
+		void lift_block( worker_state& worker, basic_block* start_block )
 		{
 			// While the basic block is not complete, populate with instructions.
 			//
 			uint64_t vip = start_block->entry_vip;
-			uint8_t* entry_ptr = input->get_at( vip );
 
-			leaders.emplace( vip, start_block );
+			// Once out of budget, leave the machine wherever the block would have started.
+			//
+			if ( is_over_budget() )
+			{
+				start_block->vexit( vip );
+				{
+					std::unique_lock _g( link_lock );
+					mark_published( start_block );
+				}
+				notify( start_block );
+				return;
+			}
+			lifted_blocks++;
+
+			// Addresses the block can be split at later on.
+			//
+			std::vector<vip_t> boundaries;
+
+			// Destinations of the block, if known without analyzing it.
+			//
+			std::vector<vip_t> destinations;
 
 			while ( true )
 			{
-				if ( !input->is_valid( vip ) )
+				if ( !input->is_valid( vip ) || is_over_budget( start_block->size() ) )
 				{
+					end_block( start_block );
 					start_block->vexit( vip );
+					{
+						std::unique_lock _g( link_lock );
+						record_block( start_block, vip, boundaries );
+						mark_published( start_block );
+					}
+					notify( start_block );
 					return;
 				}
 
+				if ( vip != start_block->entry_vip && is_boundary( start_block, vip ) )
+				{
+					boundaries.push_back( vip );
+					mark_boundary( start_block );
+				}
+
+				// The bytes are looked up for every instruction, inputs such as mapped images are only
+				// contiguous within a section.
+				//
 				start_block->label_begin(vip);
-				auto offs = arch::process( start_block, vip, entry_ptr );
+				auto offs = process( worker, start_block, vip, input->get_at( vip ) );
 				start_block->label_end();
-				entry_ptr += offs;
+				lifted_instructions++;
 				vip += offs;
 
 				if ( start_block->is_complete() )
 				{
 					if ( start_block->back().base == &ins::vxcall )
-						return populate( start_block->fork( vip ) );
+					{
+						{
+							std::unique_lock _g( link_lock );
+							record_block( start_block, vip, boundaries );
+							mark_published( start_block );
+							split_at( vip );
+							if ( auto next_blk = fork( start_block, vip ) )
+								push( worker, next_blk );
+						}
+						notify( start_block );
+						return;
+					}
 					else if ( start_block->back().base == &ins::vexit )
+					{
+						{
+							std::unique_lock _g( link_lock );
+							record_block( start_block, vip, boundaries );
+							mark_published( start_block );
+						}
+						notify( start_block );
 						return;
+					}
 					else
 						break;
 				}
 				
-				if ( auto ldr = leaders.find( vip ); ldr != leaders.cend( ) )
+				// If we hit a leader, link to it and let the branch explorer below
+				// fork into the block, lifting it if it was only discovered so far.
+				//
+				if ( is_leader( vip ) )
 				{
-					start_block
-						->jmp( vip )
-						->fork( vip );
+					end_block( start_block );
+					start_block->jmp( vip );
+					destinations = { vip };
 					break;
 				}
 			}
+			if ( destinations.empty() )
+				destinations = direct_targets( start_block );
+
+			// Drop the flag computations that are never observed before analyzing the block.
+			//
+			if ( start_block->owner->context.get<processing_flags>().eliminate_dead_flags )
+				worker.dead_flag_stats += eliminate_dead_flags( start_block );
 
-			// Try to explore branches.
+			// Try to explore branches, unless they are direct.
 			// - Do not set resolving of opaques since this block can be jumped into 
 			//   later on, we cannot make these kind of assumptions in this scope.
 			//
-			cached_tracer local_tracer = {};
-			auto lbranch_info = optimizer::aux::analyze_branch( 
-				start_block, 
-				&local_tracer, 
-				{ .cross_block = true, .pack = true } 
-			);
-			fassert( !lbranch_info.is_vm_exit );
+			if ( destinations.empty() )
+			{
+				auto lbranch_info = [ & ]
+				{
+					std::shared_lock _g( link_lock );
+					return optimizer::aux::analyze_branch( 
+						start_block, 
+						&worker.tracer, 
+						{ .cross_block = true, .pack = true } 
+					);
+				}();
+				{
+					std::unique_lock _g( link_lock );
+					traced_blocks.insert( start_block );
+				}
+
+				// If exiting the virtual machine or not all constants, vmexit, declare preserve all.
+				//
+				bool is_resolved = !lbranch_info.is_vm_exit;
+				for ( auto branch : lbranch_info.destinations )
+					is_resolved &= branch->is_constant();
+
+				if ( !is_resolved )
+				{
+					{
+						std::unique_lock _g( link_lock );
+						fassert( start_block->back().base == &ins::jmp );
+						start_block->wback().base = &ins::vexit;
+						start_block->owner->routine_convention = vtil::amd64::preserve_all_convention;
+						invalidate( start_block );
+						record_block( start_block, vip, boundaries );
+						mark_published( start_block );
+					}
+					notify( start_block );
+					return;
+				}
+
+				for ( auto branch : lbranch_info.destinations )
+					destinations.push_back( *branch->get<vip_t>() );
+			}
 
-			// If not all constants, vmexit, declare preserve all.
+			// Link the branches into the routine in a single step and queue the new blocks. Branches
+			// landing inside of a lifted block split it instead, if that block is this one the
+			// branch moves to the new block along with the rest of the instructions.
 			//
-			for ( auto branch : lbranch_info.destinations )
+			std::vector<basic_block*> successors;
+			std::vector<basic_block*> completed = { start_block };
 			{
-				if ( !branch->is_constant() )
+				std::unique_lock _g( link_lock );
+				record_block( start_block, vip, boundaries );
+
+				basic_block* tail = start_block;
+				for ( vip_t branch_imm : destinations )
 				{
-					fassert( start_block->back().base == &ins::jmp );
-					start_block->wback().base = &ins::vexit;
-					start_block->owner->routine_convention = vtil::amd64::preserve_all_convention;
-					return;
+					if ( auto split = split_at( branch_imm ); split && split->prev.front() == tail )
+					{
+						tail = split;
+						completed.push_back( tail );
+					}
+
+					if ( auto next_blk = fork( tail, branch_imm ) )
+					{
+						if ( input->is_valid( branch_imm ) )
+						{
+							successors.push_back( next_blk );
+						}
+						else
+						{
+							next_blk->vexit( branch_imm );
+							completed.push_back( next_blk );
+						}
+					}
+				}
+
+				for ( auto block : completed )
+					mark_published( block );
+			}
+			if ( !successors.empty() )
+			{
+				pending_blocks += successors.size();
+				{
+					std::lock_guard _g( worker.worklist_lock );
+					worker.worklist.push( successors );
 				}
+				wake_workers( successors.size() );
 			}
 
-			// Follow the branches.
+			for ( auto block : completed )
+				notify( block );
+		}
+
+		// Unlinks a block from the routine and deletes it along with everything recorded about it.
+		//
+		void discard( basic_block* block )
+		{
+			for ( auto next : block->next )
+				std::erase( next->prev, block );
+			for ( auto prev : block->prev )
+				std::erase( prev->next, block );
+			block->next.clear();
+			block->prev.clear();
+
+			invalidate( block );
+			index.erase( block );
+			traced_blocks.erase( block );
+			published_blocks.erase( block );
+			if ( auto it = leaders.find( block->entry_vip ); it != leaders.end() && it->second == block )
+				leaders.erase( it );
+			owner_rtn->delete_block( block );
+		}
+
+		// Re-lifts the code after the bytes in [begin, end) were patched. The blocks lifted from
+		// the range are discarded along with the blocks whose branches were resolved by tracing
+		// through them, they are lifted again from the blocks branching into them and anything
+		// the new code reaches is explored. Every other block is kept as is. Must not be called
+		// while exploring, returns the number of blocks discarded.
+		//
+		size_t relift( vip_t begin, vip_t end )
+		{
+			if constexpr ( requires { input->invalidate( begin, end ); } )
+				input->invalidate( begin, end );
+
+			auto overlapping = index.overlapping( begin, end );
+			std::unordered_set<basic_block*> affected = { overlapping.begin(), overlapping.end() };
+			if ( affected.empty() )
+				return 0;
+
+			// Any traced block downstream may have followed a path through the patched code.
 			//
-			for ( auto branch : lbranch_info.destinations )
+			std::unordered_set<basic_block*> visited = affected;
+			std::vector<basic_block*> stack = { affected.begin(), affected.end() };
+			while ( !stack.empty() )
 			{
-				const auto branch_imm = *branch->get<vip_t>();
-				if ( auto next_blk = start_block->fork( branch_imm ) )
+				auto block = stack.back();
+				stack.pop_back();
+				for ( auto next : block->next )
 				{
-					if ( input->is_valid( branch_imm ) )
-						populate( next_blk );
-					else
-						next_blk->vexit( branch_imm );
+					if ( !visited.insert( next ).second )
+						continue;
+					if ( traced_blocks.contains( next ) )
+						affected.insert( next );
+					stack.push_back( next );
 				}
 			}
+
+			// Remember the edges into and out of the affected blocks before dropping them.
+			//
+			std::vector<std::pair<basic_block*, vip_t>> incoming;
+			std::vector<basic_block*> outgoing;
+			for ( auto block : affected )
+			{
+				for ( auto prev : block->prev )
+					if ( !affected.contains( prev ) )
+						incoming.emplace_back( prev, block->entry_vip );
+				for ( auto next : block->next )
+					if ( !affected.contains( next ) )
+						outgoing.push_back( next );
+			}
+
+			const bool entry_affected = affected.contains( entry );
+			const vip_t entry_vip = entry->entry_vip;
+			for ( auto block : affected )
+				discard( block );
+			for ( auto next : outgoing )
+				invalidate( next );
+
+			// Recreate the blocks branched into, fork links the edge even if the block exists.
+			//
+			std::vector<basic_block*> start_blocks;
+			if ( entry_affected )
+			{
+				entry = owner_rtn->create_block( entry_vip ).first;
+				owner_rtn->entry_point = entry;
+				start_blocks.push_back( entry );
+			}
+			for ( auto [prev, vip] : incoming )
+			{
+				if ( auto block = prev->fork( vip ) )
+					start_blocks.push_back( block );
+			}
+			populate( start_blocks );
+
+			// Drop the blocks only the old code branched to.
+			//
+			while ( !outgoing.empty() )
+			{
+				auto block = outgoing.back();
+				outgoing.pop_back();
+				if ( affected.contains( block ) || block == entry || !block->prev.empty() )
+					continue;
+				outgoing.insert( outgoing.end(), block->next.begin(), block->next.end() );
+				discard( block );
+				affected.insert( block );
+			}
+			return affected.size();
 		}
 
-		void explore()
+		exploration_status explore()
 		{
-			populate( entry );
+			if ( entry->owner->context.get<processing_flags>().predecode_leaders )
+				discover_leaders();
+			return populate( entry );
 			//std::unordered_set<basic_block*> entries { entry };
 			//
 			//bool changed;
@@ -0,0 +1,212 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <span>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include "replay_statistics.hpp"
+
+namespace vtil::lifter
+{
+	// IL emitted by the handler of an instruction in a form that can be appended to any block.
+	// The instructions have no virtual address, their temporaries are renamed on every replay
+	// and their stack offsets are relative to the offset the block had before the handler.
+	//
+	struct il_template
+	{
+		std::vector<instruction> instructions;
+		std::vector<int64_t> sp_offsets;
+		int64_t sp_delta = 0;
+	};
+
+	// Position of a block right before the handler of an instruction runs.
+	//
+	struct capture_point
+	{
+		basic_block* block;
+		std::optional<basic_block::iterator> last;
+		int64_t sp_offset;
+		uint32_t sp_index;
+
+		capture_point( basic_block* block )
+			: block( block ), sp_offset( block->sp_offset ), sp_index( block->sp_index )
+		{
+			if ( !block->empty() )
+				last = std::prev( block->end() );
+		}
+	};
+
+	// Templates of the instructions lifted so far keyed by their encoding and decoding mode,
+	// shared by every thread lifting with the same architecture.
+	//
+	struct replay_cache
+	{
+		// Upper bound on the number of templates kept.
+		//
+		static constexpr size_t max_templates = 1 << 16;
+
+		mutable std::shared_mutex lock;
+		std::unordered_map<std::string, std::shared_ptr<const il_template>> templates;
+
+		std::atomic<size_t> hits = 0;
+		std::atomic<size_t> misses = 0;
+		std::atomic<size_t> captures = 0;
+		std::atomic<size_t> rejections = 0;
+
+		// Builds the key of an encoding, the variant tells apart lifter configurations that
+		// produce different IL for the same instruction.
+		//
+		static std::string make_key( uint8_t mode, std::span<const uint8_t> bytes, uint8_t variant = 0 )
+		{
+			std::string key( bytes.size() + 2, '\0' );
+			key[ 0 ] = char( mode );
+			key[ 1 ] = char( variant );
+			std::copy( bytes.begin(), bytes.end(), key.begin() + 2 );
+			return key;
+		}
+
+		// Looks up the template for the given key, counting the result.
+		//
+		std::shared_ptr<const il_template> lookup( const std::string& key )
+		{
+			std::shared_lock _g{ lock };
+			auto it = templates.find( key );
+			if ( it == templates.end() )
+			{
+				misses++;
+				return nullptr;
+			}
+			hits++;
+			return it->second;
+		}
+
+		// Appends the template to the block with fresh temporaries, shifting the stack as the
+		// handler it was captured from did.
+		//
+		static void replay( basic_block* block, const il_template& tmpl )
+		{
+			std::vector<std::pair<uint64_t, uint64_t>> renames;
+			auto rename = [ & ] ( uint64_t id )
+			{
+				for ( auto& [ from, to ] : renames )
+					if ( from == id )
+						return to;
+				return renames.emplace_back( id, block->last_temporary_index++ ).second;
+			};
+
+			int64_t sp_base = block->sp_offset;
+			for ( size_t n = 0; n != tmpl.instructions.size(); n++ )
+			{
+				if ( int64_t shift = sp_base + tmpl.sp_offsets[ n ] - block->sp_offset )
+					block->shift_sp( shift );
+
+				instruction ins = tmpl.instructions[ n ];
+				for ( auto& op : ins.operands )
+				{
+					if ( op.is_register() && op.reg().is_local() )
+						op.reg().local_id = rename( op.reg().local_id );
+				}
+				block->push_back( std::move( ins ) );
+			}
+
+			if ( int64_t shift = sp_base + tmpl.sp_delta - block->sp_offset )
+				block->shift_sp( shift );
+		}
+
+		// Builds a template out of the instructions appended since the capture point and stores
+		// it under the given key. The IL is rejected if it reads a temporary it did not write,
+		// which happens when the handler reused a result computed by an earlier instruction, or
+		// if it resets or branches out of the block.
+		//
+		void capture( const std::string& key, const capture_point& point )
+		{
+			basic_block* block = point.block;
+			if ( block->sp_index != point.sp_index || block->is_complete() )
+			{
+				rejections++;
+				return;
+			}
+
+			auto tmpl = std::make_shared<il_template>();
+			tmpl->sp_delta = block->sp_offset - point.sp_offset;
+
+			std::vector<uint64_t> written;
+			auto is_written = [ & ] ( uint64_t id )
+			{
+				return std::find( written.begin(), written.end(), id ) != written.end();
+			};
+
+			basic_block::iterator it = point.last ? std::next( *point.last ) : block->begin();
+			for ( ; it != block->end(); ++it )
+			{
+				if ( it->is_volatile() || it->base->is_branching() || it->sp_index != point.sp_index )
+				{
+					rejections++;
+					return;
+				}
+
+				for ( size_t n = 0; n != it->operands.size(); n++ )
+				{
+					auto& op = it->operands[ n ];
+					if ( !op.is_register() || !op.reg().is_local() )
+						continue;
+
+					auto type = it->base->operand_types[ n ];
+					if ( type != operand_type::write && !is_written( op.reg().local_id ) )
+					{
+						rejections++;
+						return;
+					}
+					if ( type >= operand_type::write )
+						written.push_back( op.reg().local_id );
+				}
+
+				instruction ins = *it;
+				ins.vip = invalid_vip;
+				tmpl->instructions.emplace_back( std::move( ins ) );
+				tmpl->sp_offsets.emplace_back( it->sp_offset - point.sp_offset );
+			}
+
+			std::unique_lock _g{ lock };
+			if ( templates.size() < max_templates && templates.emplace( key, std::move( tmpl ) ).second )
+				captures++;
+		}
+
+		replay_statistics statistics() const
+		{
+			return { hits.load(), misses.load(), captures.load(), rejections.load() };
+		}
+	};
+};
@@ -0,0 +1,134 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vtil/arch>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "processing_flags.hpp"
+
+namespace vtil::lifter
+{
+	// Queue of forked blocks that are pending lifting, handed out in the order requested
+	// by the processing flags. Every block is pushed at most once, right after it is
+	// forked, so the queue never grows beyond the number of blocks not lifted yet.
+	//
+	struct block_worklist
+	{
+		// Order blocks are handed out in.
+		//
+		exploration_order order;
+
+		// Pending blocks, kept as a min-heap on the entry address for address ordering.
+		//
+		std::deque<basic_block*> blocks;
+
+		// Constructor.
+		//
+		block_worklist( exploration_order order = exploration_order::depth_first ) : order( order ) {}
+
+		// Heap comparator placing the lowest entry address at the front.
+		//
+		static bool later_vip( const basic_block* a, const basic_block* b )
+		{
+			return a->entry_vip > b->entry_vip;
+		}
+
+		bool empty() const { return blocks.empty(); }
+		size_t size() const { return blocks.size(); }
+
+		// Queues a block to be lifted.
+		//
+		void push( basic_block* block )
+		{
+			blocks.push_back( block );
+			if ( order == exploration_order::address_order )
+				std::push_heap( blocks.begin(), blocks.end(), &later_vip );
+		}
+
+		// Queues the successors of a block in the order they were discovered, for depth first
+		// exploration they are reversed so that the first one is still lifted first.
+		//
+		void push( const std::vector<basic_block*>& successors )
+		{
+			if ( order == exploration_order::depth_first )
+				std::for_each( successors.rbegin(), successors.rend(), [ & ] ( auto* block ) { push( block ); } );
+			else
+				std::for_each( successors.begin(), successors.end(), [ & ] ( auto* block ) { push( block ); } );
+		}
+
+		// Takes the next block to lift.
+		//
+		basic_block* pop()
+		{
+			dassert( !blocks.empty() );
+
+			basic_block* block;
+			switch ( order )
+			{
+				case exploration_order::breadth_first:
+					block = blocks.front();
+					blocks.pop_front();
+					break;
+				case exploration_order::address_order:
+					std::pop_heap( blocks.begin(), blocks.end(), &later_vip );
+					[[fallthrough]];
+				default:
+					block = blocks.back();
+					blocks.pop_back();
+					break;
+			}
+			return block;
+		}
+
+		// Takes a block on behalf of another worker, from the opposite end of the queue where
+		// possible so that the owner keeps the blocks closest to what it is lifting.
+		//
+		basic_block* steal()
+		{
+			dassert( !blocks.empty() );
+
+			basic_block* block;
+			switch ( order )
+			{
+				case exploration_order::depth_first:
+					block = blocks.front();
+					blocks.pop_front();
+					break;
+				case exploration_order::breadth_first:
+					block = blocks.back();
+					blocks.pop_back();
+					break;
+				default:
+					block = pop();
+					break;
+			}
+			return block;
+		}
+	};
+};
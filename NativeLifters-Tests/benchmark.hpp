@@ -0,0 +1,110 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of VTIL Project nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <lifters/core>
+#include <lifters/amd64>
+#include <chrono>
+#include <map>
+#include <random>
+
+using namespace vtil;
+
+// Measures the cost of resolving instruction handlers through a map against
+// the flattened handler table.
+//
+static void bench_dispatch( size_t iterations = 64 )
+{
+	using clock = std::chrono::high_resolution_clock;
+
+	// Build an identifier stream resembling compiled code, mixed with a few
+	// identifiers that do not have a handler.
+	//
+	std::vector<uint8_t> code = amd64::assemble( R"(
+		push rbx
+		mov rbx, rcx
+		sub rsp, 0x20
+		mov rax, qword ptr [rsp+0x20]
+		xor eax, eax
+		test rax, rax
+		je .L
+		lea rcx, [rbx+rax*8+0x10]
+		add rax, 1
+		cmp rax, rcx
+		jb .L
+		movzx edx, byte ptr [rcx]
+		call rdx
+	.L:	imul rax, rbx
+		shl rax, 3
+		cmovne rax, rbx
+		add rsp, 0x20
+		pop rbx
+		pxor xmm0, xmm0
+		ret
+	)" );
+
+	std::vector<x86_insn> ids;
+	for ( auto& ins : amd64::disasm( code.data(), 0, code.size() ) )
+		ids.push_back( ( x86_insn ) ins.id );
+
+	std::vector<x86_insn> stream;
+	std::mt19937 gen( 0 );
+	for ( size_t i = 0; i != 0x10000; i++ )
+		stream.push_back( ids[ gen() % ids.size() ] );
+
+	auto& table = lifter::amd64::get_handler_table();
+	std::map<x86_insn, lifter::amd64::handler_t> map;
+	for ( size_t id = 0; id != table.size(); id++ )
+		if ( table[ id ] )
+			map.emplace( ( x86_insn ) id, table[ id ] );
+
+	auto measure = [ & ] ( auto&& lookup )
+	{
+		uint64_t checksum = 0;
+		auto t0 = clock::now();
+		for ( size_t n = 0; n != iterations; n++ )
+			for ( x86_insn id : stream )
+				checksum += ( uint64_t ) lookup( id );
+		auto t1 = clock::now();
+		return std::pair{ std::chrono::duration<double, std::nano>( t1 - t0 ).count() / ( iterations * stream.size() ), checksum };
+	};
+
+	auto [map_ns, map_sum] = measure( [ & ] ( x86_insn id )
+	{
+		auto it = map.find( id );
+		return it != map.end() ? it->second : nullptr;
+	} );
+	auto [table_ns, table_sum] = measure( [ & ] ( x86_insn id )
+	{
+		return table[ id ];
+	} );
+	fassert( map_sum == table_sum );
+
+	logger::log( "Handler dispatch (%zu lookups):\n", iterations * stream.size() );
+	logger::log( "  map:   %.2f ns/lookup\n", map_ns );
+	logger::log( "  table: %.2f ns/lookup\n", table_ns );
+}
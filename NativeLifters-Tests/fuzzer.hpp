@@ -34,9 +34,10 @@
 
 using namespace vtil;
 
-using amd64_recursive_descent = lifter::recursive_descent<lifter::byte_input, lifter::amd64::lifter_t>;
+using amd64_input = lifter::decoded_input<lifter::amd64::lifter_t>;
+using amd64_recursive_descent = lifter::recursive_descent<amd64_input, lifter::amd64::lifter_t>;
 
-static bool fuzz_step( const lifter::byte_input& input, bool optimize, bool dump_info )
+static bool fuzz_step( const amd64_input& input, bool optimize, bool dump_info, lifter::processing_flags flags = {} )
 {
 	std::vector GP_REGS = {
 		X86_REG_RAX,
@@ -81,7 +82,7 @@ static bool fuzz_step( const lifter::byte_input& input, bool optimize, bool dump
 
 	// Lift all bytes
 	//
-	amd64_recursive_descent rec_desc( &input, input.base );
+	amd64_recursive_descent rec_desc( &input, input.base, flags );
 	rec_desc.entry->owner->routine_convention = amd64::preserve_all_convention;
 	rec_desc.entry->owner->routine_convention.purge_stack = false;
 	rec_desc.explore();
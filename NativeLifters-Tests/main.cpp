@@ -30,11 +30,14 @@
 #include <vtil/arch>
 #include <vtil/compiler>
 #include <memory>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
 #include "fuzzer.hpp"
+#include "benchmark.hpp"
 
 using namespace vtil;
 using namespace logger;
-using amd64_recursive_descent = lifter::recursive_descent<lifter::byte_input, lifter::amd64::lifter_t>;
 
 static bool run_test(uint64_t address, const char* assembly, const char* file, int line, bool optimize, bool dump_info)
 {
@@ -47,16 +50,29 @@ static bool run_test(uint64_t address, const char* assembly, const char* file, i
 	}
 
 	
-	lifter::byte_input input = { code.data(), code.size(), address };
+	amd64_input input = lifter::byte_input{ code.data(), code.size(), address };
 
 	auto dasm = amd64::disasm(code.data(), address, code.size());
 	for (auto& ins : dasm)
 		log("%s\n", ins.to_string());
 
+	// Make sure the length pre-decoder agrees with the disassembler.
+	for (auto& ins : dasm)
+	{
+		size_t offset = ins.address - address;
+		auto info = lifter::amd64::lifter_t::predecode(ins.address, code.data() + offset, code.size() - offset);
+		if (info.length != ins.bytes.size())
+		{
+			log<CON_RED>("Pre-decoded length mismatch for %s: %d != %zu (%s:%d)\n\n", ins.to_string(), info.length, ins.bytes.size(), file, line);
+			return false;
+		}
+	}
+
 	auto passed = true;
 	for (int i = 0; i < 128; i++)
 	{
-		if (!fuzz_step(input, optimize, dump_info))
+		// Alternate between eager and lazy flags, cycle through the exploration orders and the worker counts.
+		if (!fuzz_step(input, optimize, dump_info, { .lazy_flags = (i & 1) != 0, .coalesce_flags = (i & 8) != 0, .replay_templates = (i & 4) == 0, .order = lifter::exploration_order(i % 3), .worker_count = size_t(1 + (i & 2)) }))
 		{
 			passed = false;
 		}
@@ -106,6 +122,486 @@ struct Test
 	int line = 0;
 };
 
+// Lifts code whose last instruction is cut off by the end of the input while the bytes that
+// would complete it are still mapped, they must not be decoded.
+//
+template<typename input_t>
+static bool run_truncated_test(const char* name)
+{
+	std::vector<uint8_t> code = amd64::assemble(R"(
+		mov rcx, rax
+		mov rax, 0x1122334455667788
+	)");
+	input_t input = lifter::byte_input{ code.data(), code.size() - 4 };
+
+	lifter::recursive_descent<input_t, lifter::amd64::lifter_t> rec_desc(&input, 0);
+	rec_desc.explore();
+
+	bool passed = true;
+	rec_desc.entry->owner->for_each([&](basic_block* block)
+	{
+		for (auto& ins : *block)
+			for (auto& op : ins.operands)
+				passed &= !(op.is_immediate() && op.imm().u64 == 0x1122334455667788);
+	});
+
+	if (!passed)
+	{
+		debug::dump(rec_desc.entry->owner);
+		log<CON_RED>("Truncated instruction was decoded past the end of the input (%s)\n\n", name);
+	}
+	return passed;
+}
+
+// Runs the dead flag elimination over IL modelled on "add; sub; jz", where the flags of the
+// first and the temporary feeding them are overwritten before being read, and over a block
+// whose flags are all read or live out of it. Then lifts the sequence itself.
+//
+static bool run_dead_flag_test()
+{
+	const register_desc cf = { register_physical | register_flags, 0, 1, 0 };
+	const register_desc zf = { register_physical | register_flags, 0, 1, 6 };
+
+	bool passed = true;
+	{
+		basic_block* block = basic_block::begin(0);
+		std::unique_ptr<routine> rtn{ block->owner };
+		auto t0 = block->tmp(1);
+		auto t1 = block->tmp(1);
+		block
+			->mov(t0, 1)
+			->mov(zf, t0)
+			->mov(cf, 1)
+			->mov(t1, 0)
+			->mov(zf, t1)
+			->mov(cf, 0)
+			->js(zf, 0x10ull, 0x20ull);
+
+		auto stats = lifter::eliminate_dead_flags(block);
+		passed &= stats.flag_writes == 2 && stats.temporary_writes == 1 && block->size() == 4;
+	}
+	{
+		basic_block* block = basic_block::begin(0);
+		std::unique_ptr<routine> rtn{ block->owner };
+		auto t0 = block->tmp(1);
+		block
+			->mov(zf, 1)
+			->mov(t0, zf)
+			->mov(zf, 0)
+			->js(t0, 0x10ull, 0x20ull);
+
+		auto stats = lifter::eliminate_dead_flags(block);
+		passed &= stats.flag_writes == 0 && stats.temporary_writes == 0 && block->size() == 4;
+	}
+	if (!passed)
+		log<CON_RED>("Dead flag elimination removed the wrong instructions\n\n");
+
+	// Every flag written by the add is overwritten by the sub.
+	std::vector<uint8_t> code = amd64::assemble(R"(
+		add eax, ebx
+		sub eax, ecx
+		jz .L
+		inc eax
+	.L:
+		ret
+	)");
+	amd64_input input = lifter::byte_input{ code.data(), code.size() };
+	amd64_recursive_descent rec_desc(&input, 0);
+	rec_desc.explore();
+	if (rec_desc.dead_flag_stats.flag_writes < 6)
+	{
+		debug::dump(rec_desc.entry->owner);
+		log<CON_RED>("Dead flag elimination removed %zu flag writes of the add\n\n", rec_desc.dead_flag_stats.flag_writes);
+		passed = false;
+	}
+	return passed;
+}
+
+// Writes a little endian value into the image at the given offset.
+//
+template<typename T>
+static void write_le(std::vector<uint8_t>& image, size_t offset, T value)
+{
+	memcpy(image.data() + offset, &value, sizeof(T));
+}
+
+// Writes the image out to a temporary file and maps it.
+//
+static std::unique_ptr<lifter::mapped_input> map_image(const std::vector<uint8_t>& image, const std::filesystem::path& path)
+{
+	{
+		std::ofstream file(path, std::ios::binary);
+		file.write((const char*)image.data(), image.size());
+	}
+	return lifter::mapped_input::open(path);
+}
+
+// Maps a minimal ELF image with an executable and a writable section, only the first must be exposed.
+//
+static bool run_elf_test()
+{
+	std::vector<uint8_t> image(0x260);
+	memcpy(image.data(), "\x7F" "ELF", 4);
+	image[4] = 2; // ELFCLASS64
+	image[5] = 1; // ELFDATA2LSB
+	image[6] = 1;
+	write_le<uint64_t>(image, 24, 0x401000); // e_entry
+	write_le<uint64_t>(image, 32, 0x40);     // e_phoff
+	write_le<uint64_t>(image, 40, 0x80);     // e_shoff
+	write_le<uint16_t>(image, 54, 56);       // e_phentsize
+	write_le<uint16_t>(image, 56, 1);        // e_phnum
+	write_le<uint16_t>(image, 58, 64);       // e_shentsize
+	write_le<uint16_t>(image, 60, 4);        // e_shnum
+	write_le<uint16_t>(image, 62, 3);        // e_shstrndx
+
+	// PT_LOAD covering both sections.
+	write_le<uint32_t>(image, 0x40, 1);
+	write_le<uint32_t>(image, 0x44, 7);
+	write_le<uint64_t>(image, 0x48, 0x200);
+	write_le<uint64_t>(image, 0x50, 0x401000);
+	write_le<uint64_t>(image, 0x60, 0x20);
+
+	// Section headers: null, .text, .data and .shstrtab.
+	auto add_section = [&](size_t index, uint32_t name, uint32_t type, uint64_t flags, uint64_t addr, uint64_t offset, uint64_t size)
+	{
+		size_t sh = 0x80 + index * 64;
+		write_le<uint32_t>(image, sh, name);
+		write_le<uint32_t>(image, sh + 4, type);
+		write_le<uint64_t>(image, sh + 8, flags);
+		write_le<uint64_t>(image, sh + 16, addr);
+		write_le<uint64_t>(image, sh + 24, offset);
+		write_le<uint64_t>(image, sh + 32, size);
+	};
+	const char strtab[] = "\0.text\0.data\0.shstrtab";
+	add_section(1, 1, 1, 6, 0x401000, 0x200, 0x10);
+	add_section(2, 7, 1, 3, 0x401010, 0x210, 0x10);
+	add_section(3, 13, 3, 0, 0, 0x240, sizeof(strtab));
+	memcpy(image.data() + 0x240, strtab, sizeof(strtab));
+
+	// mov eax, 1; ret
+	const uint8_t code[] = { 0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3 };
+	memcpy(image.data() + 0x200, code, sizeof(code));
+
+	auto path = std::filesystem::temp_directory_path() / "vtil_lifter_fixture.elf";
+	bool passed = false;
+	if (auto input = map_image(image, path))
+	{
+		auto text = input->find_section(0x401004);
+		passed = input->entry_point == 0x401000 && input->sections.size() == 1 &&
+			text && text->name == ".text" && input->get_at(0x401000)[0] == 0xB8 &&
+			input->get_remaining(0x401004) == 0xC &&
+			!input->is_valid(0x401010) && !input->is_valid(0x400FFF);
+	}
+	std::filesystem::remove(path);
+
+	if (!passed)
+		log<CON_RED>("ELF image was not mapped as expected\n\n");
+	return passed;
+}
+
+// Maps a minimal PE image whose two executable sections are contiguous in memory but not in the
+// file, followed by a data section. Code running off the end of the first must be lifted from
+// the raw data of the second.
+//
+static bool run_pe_test()
+{
+	constexpr uint64_t image_base = 0x140000000;
+	std::vector<uint8_t> image(0x610);
+	memcpy(image.data(), "MZ", 2);
+	write_le<uint32_t>(image, 0x3C, 0x40);
+	memcpy(image.data() + 0x40, "PE\0\0", 4);
+	write_le<uint16_t>(image, 0x44, 0x8664); // Machine
+	write_le<uint16_t>(image, 0x46, 3);      // NumberOfSections
+	write_le<uint16_t>(image, 0x54, 0xF0);   // SizeOfOptionalHeader
+	write_le<uint16_t>(image, 0x58, 0x20B);  // Magic
+	write_le<uint32_t>(image, 0x68, 0x1000); // AddressOfEntryPoint
+	write_le<uint64_t>(image, 0x70, image_base);
+
+	auto add_section = [&](size_t index, const char* name, uint32_t rva, uint32_t raw_offset, uint32_t characteristics)
+	{
+		size_t sh = 0x148 + index * 40;
+		memcpy(image.data() + sh, name, strlen(name));
+		write_le<uint32_t>(image, sh + 8, 0x10);
+		write_le<uint32_t>(image, sh + 12, rva);
+		write_le<uint32_t>(image, sh + 16, 0x10);
+		write_le<uint32_t>(image, sh + 20, raw_offset);
+		write_le<uint32_t>(image, sh + 36, characteristics);
+	};
+	add_section(0, ".text", 0x1000, 0x200, 0x60000020);
+	add_section(1, ".text2", 0x1010, 0x400, 0x60000020);
+	add_section(2, ".data", 0x2000, 0x600, 0xC0000040);
+
+	// nop x11; mov eax, 1 | mov ecx, 2; ret
+	memset(image.data() + 0x200, 0x90, 11);
+	const uint8_t first[] = { 0xB8, 0x01, 0x00, 0x00, 0x00 };
+	const uint8_t second[] = { 0xB9, 0x02, 0x00, 0x00, 0x00, 0xC3 };
+	memcpy(image.data() + 0x200 + 11, first, sizeof(first));
+	memcpy(image.data() + 0x400, second, sizeof(second));
+	memset(image.data() + 0x600, 0xC3, 0x10);
+
+	auto path = std::filesystem::temp_directory_path() / "vtil_lifter_fixture.exe";
+	bool passed = false;
+	if (auto input = map_image(image, path))
+	{
+		auto second_section = input->find_section(image_base + 0x1010);
+		passed = input->entry_point == image_base + 0x1000 && input->sections.size() == 2 &&
+			second_section && second_section->name == ".text2" &&
+			input->get_remaining(image_base + 0x100B) == 5 &&
+			!input->is_valid(image_base + 0x2000) && !input->is_valid(image_base + 0x1020);
+
+		if (passed)
+		{
+			lifter::recursive_descent<lifter::mapped_input, lifter::amd64::lifter_t> rec_desc(input.get(), input->entry_point);
+			rec_desc.explore();
+
+			bool found = false;
+			rec_desc.entry->owner->for_each([&](basic_block* blk)
+			{
+				for (auto& ins : *blk)
+				{
+					if (ins.vip != image_base + 0x1010)
+						continue;
+					for (auto& op : ins.operands)
+						found |= op.is_immediate() && op.imm().u64 == 2;
+				}
+			});
+			passed = found;
+			if (!passed)
+				debug::dump(rec_desc.entry->owner);
+		}
+	}
+	std::filesystem::remove(path);
+
+	if (!passed)
+		log<CON_RED>("PE image was not mapped or lifted as expected\n\n");
+	return passed;
+}
+
+// Checks that no instruction was lifted into more than one block of the routine.
+//
+static bool has_unique_vips(routine* rtn)
+{
+	std::unordered_map<vip_t, basic_block*> owners;
+	bool unique = true;
+	rtn->for_each([&](basic_block* blk)
+	{
+		for (auto& ins : *blk)
+		{
+			if (ins.vip == invalid_vip)
+				continue;
+			auto [it, inserted] = owners.try_emplace(ins.vip, blk);
+			unique &= inserted || it->second == blk;
+		}
+	});
+	return unique;
+}
+
+// Lifts a loop branching back into the middle of the entry block, which must be split at the loop
+// head rather than have the loop body lifted a second time, in every exploration order.
+//
+static bool run_split_test()
+{
+	std::vector<uint8_t> code = amd64::assemble(R"(
+		xor eax, eax
+		mov ecx, 3
+	.loop:
+		add eax, ecx
+		dec ecx
+		jnz .loop
+	)");
+	amd64_input input = lifter::byte_input{ code.data(), code.size() };
+	auto dasm = amd64::disasm(code.data(), 0, code.size());
+	const vip_t loop_head = dasm[2].address;
+
+	bool passed = true;
+	for (int order = 0; order != 3; order++)
+	{
+		amd64_recursive_descent rec_desc(&input, 0, { .order = lifter::exploration_order(order) });
+		rec_desc.explore();
+
+		basic_block* loop = rec_desc.entry->owner->find_block(loop_head);
+		if (!loop || loop == rec_desc.entry || !has_unique_vips(rec_desc.entry->owner))
+		{
+			debug::dump(rec_desc.entry->owner);
+			log<CON_RED>("Loop head was not split off the entry block (order %d)\n\n", order);
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+// Lifts a conditional branch over code falling through into its destination. The destination
+// is queued before the fall-through is lifted, which must end at it rather than lift it again,
+// whatever order the blocks are taken in.
+//
+static bool run_leader_test()
+{
+	std::vector<uint8_t> code = amd64::assemble(R"(
+		test eax, eax
+		jz .L
+		mov ecx, 1
+		add ecx, edx
+	.L:
+		mov eax, ecx
+		ret
+	)");
+	amd64_input input = lifter::byte_input{ code.data(), code.size() };
+
+	bool passed = true;
+	for (size_t worker_count : { 1, 4 })
+	{
+		amd64_recursive_descent rec_desc(&input, 0, { .order = lifter::exploration_order::address_order, .worker_count = worker_count });
+		rec_desc.explore();
+		if (!has_unique_vips(rec_desc.entry->owner))
+		{
+			debug::dump(rec_desc.entry->owner);
+			log<CON_RED>("Code was lifted into two blocks with %zu workers\n\n", worker_count);
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+// Assembles both functions sharing a tail out of the batch store, the routines must only link
+// blocks of their own.
+//
+static bool run_batch_test()
+{
+	std::vector<uint8_t> code = amd64::assemble(R"(
+		mov eax, 1
+		jmp .tail
+		mov eax, 2
+		jmp .tail
+	.tail:
+		add eax, ecx
+		ret
+	)");
+	amd64_input input = lifter::byte_input{ code.data(), code.size() };
+	auto dasm = amd64::disasm(code.data(), 0, code.size());
+
+	lifter::batch_descent<amd64_input, lifter::amd64::lifter_t> batch(&input, { dasm[0].address, dasm[2].address });
+	batch.explore();
+
+	bool passed = true;
+	for (vip_t vip : batch.entry_points)
+	{
+		auto rtn = batch.assemble(vip);
+		if (!rtn || rtn->entry_point->entry_vip != vip || !rtn->entry_point->prev.empty())
+		{
+			log<CON_RED>("Failed to assemble the function at %llx\n\n", vip);
+			passed = false;
+			continue;
+		}
+
+		size_t block_count = 0;
+		rtn->for_each([&](basic_block* blk)
+		{
+			block_count++;
+			for (auto* links : { &blk->prev, &blk->next })
+			{
+				for (auto* other : *links)
+					passed &= other->owner == rtn.get() && rtn->find_block(other->entry_vip) == other;
+			}
+		});
+		passed &= block_count == 2;
+
+		if (!passed)
+		{
+			debug::dump(rtn.get());
+			log<CON_RED>("Assembled function at %llx links blocks outside of it\n\n", vip);
+		}
+	}
+
+	// The store itself must be left intact.
+	basic_block* tail = batch.store.owner_rtn->find_block(dasm[4].address);
+	passed &= tail && tail->prev.size() == 2;
+	return passed;
+}
+
+// Patches an instruction lifted into two blocks, one handed to the observer before the branch
+// into its middle was found and the one lifted from that branch, then re-lifts the code. Both
+// must pick up the new code while the blocks not covering it are kept as is.
+//
+static bool run_relift_test()
+{
+	std::vector<uint8_t> code = amd64::assemble(R"(
+		je .second
+		mov eax, 1
+	.inner:
+		mov ecx, 2
+		ret
+	.second:
+		jmp .inner
+	)");
+	amd64_input input = lifter::byte_input{ code.data(), code.size() };
+	auto dasm = amd64::disasm(code.data(), 0, code.size());
+	const vip_t patched = dasm[2].address;
+
+	amd64_recursive_descent rec_desc(&input, 0, { .order = lifter::exploration_order::address_order });
+	rec_desc.on_block_complete = [](basic_block*) {};
+	rec_desc.explore();
+
+	auto covers = [&](basic_block* blk)
+	{
+		return std::any_of(blk->begin(), blk->end(), [&](const instruction& ins) { return ins.vip == patched; });
+	};
+
+	size_t covering = 0;
+	std::vector<basic_block*> untouched;
+	rec_desc.entry->owner->for_each([&](basic_block* blk)
+	{
+		if (covers(blk))
+			covering++;
+		else
+			untouched.push_back(blk);
+	});
+	if (covering != 2)
+	{
+		debug::dump(rec_desc.entry->owner);
+		log<CON_RED>("Expected the patched instruction to be lifted into two blocks, found %zu\n\n", covering);
+		return false;
+	}
+
+	code[patched + 1] = 3;
+	rec_desc.relift(patched + 1, patched + 2);
+
+	bool passed = true;
+	for (auto blk : untouched)
+		passed &= rec_desc.entry->owner->find_block(blk->entry_vip) == blk;
+
+	covering = 0;
+	rec_desc.entry->owner->for_each([&](basic_block* blk)
+	{
+		if (!covers(blk))
+			return;
+		covering++;
+
+		bool patched_imm = false;
+		for (auto& ins : *blk)
+		{
+			if (ins.vip != patched)
+				continue;
+			for (auto& op : ins.operands)
+			{
+				if (op.is_immediate())
+				{
+					patched_imm |= op.imm().u64 == 3;
+					passed &= op.imm().u64 != 2;
+				}
+			}
+		}
+		passed &= patched_imm;
+	});
+	passed &= covering != 0;
+
+	if (!passed)
+	{
+		debug::dump(rec_desc.entry->owner);
+		log<CON_RED>("Re-lifting the patched code kept stale blocks or discarded untouched ones\n\n");
+	}
+	return passed;
+}
+
 static bool runTests()
 {
 	std::vector<Test> tests;
@@ -189,6 +685,34 @@ pop rbx)");
 	.L: nop
 	)");
 
+	TEST(R"(
+		mov rax, 1
+		cmp rbx, rcx
+		jbe .L
+		mov rax, 2
+	.L: nop
+	)");
+	TEST(R"(
+		mov rax, 1
+		cmp ebx, 5
+		jle .L
+		mov rax, 2
+	.L: nop
+	)");
+	TEST(R"(
+		cmp rbx, rcx
+		setle al
+		cmp rdx, rcx
+		setge ah
+		test rsi, rdi
+		cmovg rbx, rcx
+	)");
+	TEST(R"(
+		cmp rbx, rcx
+		lea rax, [rbx + rcx]
+		seta al
+	)");
+
 	TEST("shl al, 1");
 	TEST("shl al, cl");
 	TEST("shl al, 5");
@@ -230,6 +754,16 @@ pop rbx)");
 		pop rax
 	)" );
 
+	// Branch into the middle of the entry block, which should be split.
+	TEST( R"(
+		xor eax, eax
+		mov ecx, 3
+	.loop:
+		add eax, ecx
+		dec ecx
+		jnz .loop
+	)" );
+
 	size_t passed = 0;
 	for (size_t i = 0; i < tests.size(); i++)
 	{
@@ -237,8 +771,17 @@ pop rbx)");
 		passed += run_test(test.address, test.assembly, test.file, test.line, false, false);
 	}
 
+	bool truncated_passed = run_truncated_test<lifter::byte_input>("byte_input") &
+		run_truncated_test<amd64_input>("decoded_input");
+	bool batch_passed = run_batch_test();
+	bool relift_passed = run_relift_test();
+	bool leader_passed = run_leader_test();
+	bool split_passed = run_split_test();
+	bool dead_flag_passed = run_dead_flag_test();
+	bool image_passed = run_elf_test() & run_pe_test();
+
 	log("%zu/%zu tests passed\n", passed, tests.size());
-	return passed == tests.size();
+	return passed == tests.size() && truncated_passed && batch_passed && relift_passed && leader_passed && split_passed && dead_flag_passed && image_passed;
 }
 
 #define EXPERIMENT(address, assembly) run_test(address, assembly, __FILENAME__, __LINE__, false, false)
@@ -250,6 +793,29 @@ int main(int argc, char** argv)
 		return runTests() ? 0 : 1;
 	}
 
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+	{
+		bench_dispatch();
+		return 0;
+	}
+
+	if (argc > 2 && strcmp(argv[1], "--file") == 0)
+	{
+		// Lift the routine at the given address, or the entry point, out of an ELF or PE image.
+		auto input = lifter::mapped_input::open(argv[2]);
+		if (!input)
+		{
+			log<CON_RED>("Failed to map %s\n", argv[2]);
+			return 1;
+		}
+
+		uint64_t address = argc > 3 ? strtoull(argv[3], nullptr, 16) : input->entry_point;
+		lifter::recursive_descent<lifter::mapped_input, lifter::amd64::lifter_t> rec_desc(input.get(), address);
+		rec_desc.explore();
+		debug::dump(rec_desc.entry->owner);
+		return 0;
+	}
+
 	{
 
 
@@ -266,7 +832,7 @@ int main(int argc, char** argv)
         ret
 
 	)" );
-		lifter::byte_input input = { code.data(), code.size() };
+		amd64_input input = lifter::byte_input{ code.data(), code.size() };
 
 		auto dasm = amd64::disasm( code.data(), 0, code.size() );
 		for ( auto& ins : dasm )
@@ -274,13 +840,42 @@ int main(int argc, char** argv)
 
 		amd64_recursive_descent rec_desc( &input, 0 );
 		rec_desc.entry->owner->routine_convention = amd64::default_call_convention;
+		rec_desc.on_block_complete = [](basic_block* blk) { log("Completed block %llx\n", blk->entry_vip); };
 		rec_desc.entry->owner->routine_convention.purge_stack = false;
-		rec_desc.explore();
+		if (auto status = rec_desc.explore(); status != lifter::exploration_status::complete)
+			log<CON_YLW>("Exploration stopped early (%d)\n", (int)status);
+		log("Removed %zu dead flag writes and %zu temporaries\n", rec_desc.dead_flag_stats.flag_writes, rec_desc.dead_flag_stats.temporary_writes);
+		log("Tracer cache served %zu lookups and missed %zu\n", rec_desc.tracer_stats.hits, rec_desc.tracer_stats.misses);
+		auto replay_stats = lifter::amd64::lifter_t::replay_stats();
+		log("Replayed %zu instructions from %zu templates, %.1f%% hit rate\n", replay_stats.hits, replay_stats.captures, replay_stats.hit_rate() * 100);
 
 		optimizer::apply_all_profiled( rec_desc.entry->owner );
 		debug::dump( rec_desc.entry->owner );
 	}
 
+	{
+		// Two functions sharing their tail, which should only be lifted once.
+		std::vector<uint8_t> code = amd64::assemble( R"(
+        mov     eax, 1
+        jmp     .tail
+        mov     eax, 2
+        jmp     .tail
+.tail:
+        add     eax, ecx
+        ret
+	)" );
+		amd64_input input = lifter::byte_input{ code.data(), code.size() };
+		auto dasm = amd64::disasm( code.data(), 0, code.size() );
+
+		lifter::batch_descent<amd64_input, lifter::amd64::lifter_t> batch( &input, { dasm[ 0 ].address, dasm[ 2 ].address } );
+		batch.explore();
+		log( "Lifted %zu blocks for %zu referenced, saved %zu instructions\n",
+			 batch.stats.lifted_blocks, batch.stats.referenced_blocks, batch.stats.saved_instructions() );
+
+		for ( vip_t vip : batch.entry_points )
+			debug::dump( batch.assemble( vip ).get() );
+	}
+
 
 
 